@@ -0,0 +1,262 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "settings.h"
+#include "cell_order.h"
+
+namespace
+{
+    // Set-associative LRU cache model with 64-byte lines, counts misses of a simulated access stream
+    class CacheModel
+    {
+    public:
+        CacheModel(size_t sizeBytes, size_t ways)
+            : ways(ways), sets(sizeBytes / kLineSize / ways), tags(sets * ways, UINT64_MAX), ages(sets * ways, 0)
+        {
+        }
+
+        void Access(const void* address)
+        {
+            uint64_t line = (uint64_t)(uintptr_t)address / kLineSize;
+            size_t set = line % sets;
+            uint64_t* setTags = &tags[set * ways];
+            uint64_t* setAges = &ages[set * ways];
+            clock++;
+            size_t victim = 0;
+            for (size_t way = 0; way < ways; way++)
+            {
+                if (setTags[way] == line)
+                {
+                    setAges[way] = clock;
+                    return;
+                }
+                if (setAges[way] < setAges[victim])
+                    victim = way;
+            }
+            misses++;
+            setTags[victim] = line;
+            setAges[victim] = clock;
+        }
+
+        uint64_t misses = 0;
+
+    private:
+        static constexpr size_t kLineSize = 64;
+        size_t ways;
+        size_t sets;
+        std::vector<uint64_t> tags;
+        std::vector<uint64_t> ages;
+        uint64_t clock = 0;
+    };
+
+    // Compares cell orderings on a large synthetic grid. Boids are stored in cell order,
+    // as after a reorder, and every boid sweeps its 3x3 cell neighborhood. The sweep is
+    // timed on the host and replayed through L1-sized and L2-sized cache models.
+    void RunCellOrderingBenchmark()
+    {
+        const int side = 1024;
+        const int boidsPerCell = 2;
+        const size_t cellCount = (size_t)side * side;
+        const size_t boidCount = cellCount * boidsPerCell;
+
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> coordinate(0.0f, (float)side);
+        std::vector<float> xs(boidCount), ys(boidCount);
+        for (size_t i = 0; i < boidCount; i++)
+        {
+            xs[i] = coordinate(random);
+            ys[i] = coordinate(random);
+        }
+
+        printf("Cell ordering benchmark: %dx%d cells, %zu boids\n", side, side, boidCount);
+        printf("%-10s %10s %16s %16s %14s\n", "ordering", "sweep ms", "L1 misses/boid", "L2 misses/boid", "stencil span");
+
+        const CellOrdering orderings[] = { CellOrdering::RowMajor, CellOrdering::Morton, CellOrdering::Hilbert };
+        const char* names[] = { "row", "morton", "hilbert" };
+        for (int o = 0; o < 3; o++)
+        {
+            CellOrdering ordering = orderings[o];
+
+            // Counting sort of the boids into cell order
+            std::vector<int> cellIds(boidCount);
+            std::vector<unsigned int> cellStart(cellCount + 1, 0);
+            for (size_t i = 0; i < boidCount; i++)
+            {
+                cellIds[i] = LinearCellId(ordering, (int)xs[i], (int)ys[i], side, side);
+                cellStart[cellIds[i] + 1]++;
+            }
+            for (size_t c = 0; c < cellCount; c++)
+                cellStart[c + 1] += cellStart[c];
+            std::vector<unsigned int> cursor(cellStart.begin(), cellStart.end() - 1);
+            std::vector<float> x(boidCount), y(boidCount);
+            for (size_t i = 0; i < boidCount; i++)
+            {
+                unsigned int slot = cursor[cellIds[i]]++;
+                x[slot] = xs[i];
+                y[slot] = ys[i];
+            }
+
+            // Collect the stencil cells of every boid in slot order
+            std::vector<int> stencil;
+            stencil.reserve(boidCount * 9);
+            double span = 0.0;
+            for (size_t k = 0; k < boidCount; k++)
+            {
+                int col = (int)x[k];
+                int row = (int)y[k];
+                int low = INT32_MAX, high = 0;
+                for (int dr = -1; dr <= 1; dr++)
+                    for (int dc = -1; dc <= 1; dc++)
+                    {
+                        if (col + dc < 0 || col + dc >= side || row + dr < 0 || row + dr >= side)
+                            continue;
+                        int cell = LinearCellId(ordering, col + dc, row + dr, side, side);
+                        stencil.push_back(cell);
+                        low = cell < low ? cell : low;
+                        high = cell > high ? cell : high;
+                    }
+                stencil.push_back(-1);
+                span += high - low;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            float checksum = 0.0f;
+            for (size_t s = 0, k = 0; s < stencil.size(); s++)
+            {
+                if (stencil[s] < 0)
+                {
+                    k++;
+                    continue;
+                }
+                for (unsigned int p = cellStart[stencil[s]]; p < cellStart[stencil[s] + 1]; p++)
+                    checksum += x[p] - x[k] + y[p] - y[k];
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            CacheModel l1(32 * 1024, 8);
+            CacheModel l2(1024 * 1024, 16);
+            for (size_t s = 0; s < stencil.size(); s++)
+            {
+                if (stencil[s] < 0)
+                    continue;
+                l1.Access(&cellStart[stencil[s]]);
+                l2.Access(&cellStart[stencil[s]]);
+                for (unsigned int p = cellStart[stencil[s]]; p < cellStart[stencil[s] + 1]; p++)
+                {
+                    l1.Access(&x[p]);
+                    l1.Access(&y[p]);
+                    l2.Access(&x[p]);
+                    l2.Access(&y[p]);
+                }
+            }
+
+            printf("%-10s %10.1f %16.3f %16.3f %14.1f   (checksum %g)\n", names[o], milliseconds,
+                (double)l1.misses / boidCount, (double)l2.misses / boidCount, span / boidCount, checksum);
+        }
+    }
+
+    constexpr int kBenchmarkWarmupFrames = 2;
+    constexpr int kBenchmarkFrames = 10;
+
+    // Starting flock packed into clumps of the given radius around the window center, 0 clumps spreads
+    // the boids uniformly inside the margins like InitializeInput
+    void MakeClusteredFlock(Boids& boids, int clumps, float radius, unsigned int seed)
+    {
+        const float pi = 3.14159265f;
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (size_t i = 0; i < kUnitCount; i++)
+        {
+            if (clumps == 0)
+            {
+                boids.positions.x[i] = kMarginSize + unit(random) * (kWindowWidth - 2 * kMarginSize);
+                boids.positions.y[i] = kMarginSize + unit(random) * (kWindowHeight - 2 * kMarginSize);
+            }
+            else
+            {
+                float clumpAngle = 2 * pi * (i % clumps) / clumps;
+                float clumpDistance = clumps > 1 ? 250.0f : 0.0f;
+                float angle = 2 * pi * unit(random);
+                float distance = radius * std::sqrt(unit(random));
+                boids.positions.x[i] = kWindowWidth / 2 + clumpDistance * std::cos(clumpAngle) + distance * std::cos(angle);
+                boids.positions.y[i] = kWindowHeight / 2 + clumpDistance * std::sin(clumpAngle) + distance * std::sin(angle);
+            }
+            float heading = 2 * pi * unit(random);
+            boids.velocities.vx[i] = kMinSpeed * std::cos(heading);
+            boids.velocities.vy[i] = kMinSpeed * std::sin(heading);
+            boids.ids[i] = i;
+        }
+    }
+
+    // Starting flock strung along lanes of the given width, lane 0 follows the bottom margin, lane 1 the top one
+    void MakeLaneFlock(Boids& boids, int lanes, float width, unsigned int seed)
+    {
+        const float pi = 3.14159265f;
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (size_t i = 0; i < kUnitCount; i++)
+        {
+            float lane = i % lanes == 0 ? kMarginSize / 2 : kWindowHeight - kMarginSize / 2;
+            boids.positions.x[i] = unit(random) * kWindowWidth;
+            boids.positions.y[i] = lane + (unit(random) - 0.5f) * width;
+            float heading = 2 * pi * unit(random);
+            boids.velocities.vx[i] = kMinSpeed * std::cos(heading);
+            boids.velocities.vy[i] = kMinSpeed * std::sin(heading);
+            boids.ids[i] = i;
+        }
+    }
+
+    // Compares the grids with the BVH on flocks collapsed into dense clumps, where a kVisualRange cell
+    // holds thousands of boids. Every method starts from the same flock. renderFrame(settings) renders one
+    // frame, resetState() drops state carried between frames.
+    template <typename FrameFunc, typename ResetFunc>
+    void RunClusteredBenchmark(sycl::queue& q, const Settings& settings, Boids* boids, FrameFunc renderFrame, ResetFunc resetState)
+    {
+        struct Scenario { const char* name; int clumps; float radius; int lanes; };
+        const Scenario scenarios[] = { { "uniform", 0, 0.0f, 0 }, { "16 clumps", 16, 60.0f, 0 }, { "4 clumps", 4, 40.0f, 0 }, { "1 clump", 1, 30.0f, 0 },
+            { "2 lanes", 0, 20.0f, 2 }, { "1 lane", 0, 20.0f, 1 } };
+        const GridMethod methods[] = { GridMethod::Sort, GridMethod::Counting, GridMethod::Bucket, GridMethod::Hash, GridMethod::Bvh, GridMethod::Sweep, GridMethod::Auto };
+        const char* names[] = { "sort", "counting", "bucket", "hash", "bvh", "sweep", "auto" };
+
+        std::unique_ptr<Boids> flock(new Boids());
+        printf("Clustered benchmark: %zu boids, %d warm-up and %d timed frames, ms/frame\n", kUnitCount, kBenchmarkWarmupFrames, kBenchmarkFrames);
+        printf("%-10s", "flock");
+        for (const char* name : names)
+            printf(" %10s", name);
+        printf("\n");
+
+        for (const Scenario& scenario : scenarios)
+        {
+            if (scenario.lanes > 0)
+                MakeLaneFlock(*flock, scenario.lanes, scenario.radius, 1234);
+            else
+                MakeClusteredFlock(*flock, scenario.clumps, scenario.radius, 1234);
+            printf("%-10s", scenario.name);
+            for (GridMethod method : methods)
+            {
+                Settings trial = settings;
+                trial.gridMethod = method;
+                q.memcpy(boids, flock.get(), sizeof(Boids)).wait();
+                resetState();
+                for (int frame = 0; frame < kBenchmarkWarmupFrames; frame++)
+                    renderFrame(trial);
+                auto start = std::chrono::steady_clock::now();
+                for (int frame = 0; frame < kBenchmarkFrames; frame++)
+                    renderFrame(trial);
+                q.wait();
+                printf(" %10.2f", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / kBenchmarkFrames);
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+    }
+}
+#endif
@@ -0,0 +1,41 @@
+#ifndef BOIDS_H
+#define BOIDS_H
+#include "constants.h"
+
+struct Positions
+{
+    float x[kUnitCount];
+    float y[kUnitCount];
+};
+
+struct Velocities
+{
+    float vx[kUnitCount];
+    float vy[kUnitCount];
+};
+
+struct Point
+{
+    float x;
+    float y;
+};
+
+struct TrianglePositions
+{
+    Point p1, p2, p3;
+};
+
+struct Boids
+{
+    Positions positions;
+    Velocities velocities;
+    TrianglePositions trianglePositions[kUnitCount];    // indexed by external boid id
+    int ids[kUnitCount];                                // external id of the boid stored in every slot
+};
+
+struct IdPair
+{
+    int id;
+    int cellId;
+};
+#endif
@@ -0,0 +1,38 @@
+#ifndef CELL_BINNING_H
+#define CELL_BINNING_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "radix_sort.h"
+
+namespace
+{
+    // Groups particlesGrid by cell without a comparison sort: histogram with
+    // atomic ranks, exclusive scan into cellStart, then a scatter into binnedGrid.
+    // cellEnd is the exclusive end of every cell, so empty cells have cellStart == cellEnd.
+    void BinParticles(sycl::queue& q, const IdPair* particlesGrid, IdPair* binnedGrid, int* cellRank,
+        unsigned int* cellStart, unsigned int* cellEnd, int tableSize, SortScratch& scratch)
+    {
+        sycl::range<1> numItems{ kUnitCount };
+        sycl::range<1> numCells{ (size_t)tableSize };
+
+        q.memset(cellEnd, 0, tableSize * sizeof(unsigned int)).wait();
+
+        // Histogram, cellEnd temporarily holds the count of every cell
+        q.parallel_for(numItems, [=](sycl::id<1> i) {
+            sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                sycl::access::address_space::global_space> count(cellEnd[particlesGrid[i].cellId]);
+            cellRank[i] = count.fetch_add(1u);
+            }).wait();
+
+        ExclusiveScan(q, cellEnd, cellStart, tableSize, scratch);
+
+        q.parallel_for(numItems, [=](sycl::id<1> i) {
+            binnedGrid[cellStart[particlesGrid[i].cellId] + cellRank[i]] = particlesGrid[i];
+            });
+        q.parallel_for(numCells, [=](sycl::id<1> c) {
+            cellEnd[c] += cellStart[c];
+            });
+        q.wait();
+    }
+}
+#endif
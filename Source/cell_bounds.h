@@ -0,0 +1,91 @@
+#ifndef CELL_BOUNDS_H
+#define CELL_BOUNDS_H
+#include <CL/sycl.hpp>
+#include <cfloat>
+#include "boids.h"
+#include "cell_order.h"
+
+// Bounding box of the boids in one cell
+struct CellBox
+{
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+};
+
+// Per-frame summary of the grid that lets a neighbor sweep reject a whole cell with one test
+struct CellBounds
+{
+    unsigned int* occupancy;    // one bit per cell id, set when the cell holds a boid
+    CellBox* boxes;             // valid for occupied cells only
+    bool valid = false;         // built for the current grid, otherwise no cell is rejected
+};
+
+namespace
+{
+    constexpr int kOccupancyWordBits = 32;
+
+    CellBounds AllocateCellBounds(sycl::queue& q)
+    {
+        CellBounds bounds;
+        bounds.occupancy = (unsigned int*)sycl::malloc_device((kCellTableCapacity / kOccupancyWordBits + 1) * sizeof(unsigned int), q);
+        bounds.boxes = (CellBox*)sycl::malloc_device(kCellTableCapacity * sizeof(CellBox), q);
+        return bounds;
+    }
+
+    void FreeCellBounds(sycl::queue& q, CellBounds& bounds)
+    {
+        sycl::free(bounds.occupancy, q);
+        sycl::free(bounds.boxes, q);
+    }
+
+    // Fills the occupancy bitmap and the boxes from a freshly built grid.
+    // forEachInCell(cell, visit) calls visit(j) for every boid j in the cell.
+    template <typename CellFunc>
+    void BuildCellBounds(sycl::queue& q, const Boids* boids, const GridLayout& layout, CellBounds& bounds, CellFunc forEachInCell)
+    {
+        unsigned int* occupancy = bounds.occupancy;
+        CellBox* boxes = bounds.boxes;
+
+        q.memset(occupancy, 0, (layout.tableSize / kOccupancyWordBits + 1) * sizeof(unsigned int)).wait();
+        q.parallel_for(sycl::range<1>{ (size_t)layout.tableSize }, [=](sycl::id<1> id) {
+            int cell = id;
+            bool occupied = false;
+            CellBox box = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+            forEachInCell(cell, [&](int j) {
+                occupied = true;
+                box.minX = sycl::min(box.minX, boids->positions.x[j]);
+                box.minY = sycl::min(box.minY, boids->positions.y[j]);
+                box.maxX = sycl::max(box.maxX, boids->positions.x[j]);
+                box.maxY = sycl::max(box.maxY, boids->positions.y[j]);
+                });
+            if (!occupied)
+                return;
+            boxes[cell] = box;
+            sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                sycl::access::address_space::global_space> word(occupancy[cell / kOccupancyWordBits]);
+            word.fetch_or(1u << (cell % kOccupancyWordBits));
+            }).wait();
+        bounds.valid = true;
+    }
+
+    // Squared distance from (x, y) to the closest point of the box, 0 inside
+    inline float BoxDistanceSquared(const CellBox& box, float x, float y)
+    {
+        float dx = sycl::max(sycl::max(box.minX - x, x - box.maxX), 0.0f);
+        float dy = sycl::max(sycl::max(box.minY - y, y - box.maxY), 0.0f);
+        return dx * dx + dy * dy;
+    }
+
+    // False when no boid of the cell can be within range of (x, y)
+    inline bool CellMayHold(const CellBounds& bounds, int cell, float x, float y, float range)
+    {
+        if (!bounds.valid)
+            return true;
+        if ((bounds.occupancy[cell / kOccupancyWordBits] & (1u << (cell % kOccupancyWordBits))) == 0)
+            return false;
+        return BoxDistanceSquared(bounds.boxes[cell], x, y) <= range * range;
+    }
+}
+#endif
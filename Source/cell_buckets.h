@@ -0,0 +1,128 @@
+#ifndef CELL_BUCKETS_H
+#define CELL_BUCKETS_H
+#include <CL/sycl.hpp>
+#include <cstdio>
+#include "boids.h"
+#include "cell_order.h"
+#include "radix_sort.h"
+
+// Every cell owns the same number of slots, boids past a full bucket go to one shared overflow list
+// that is grouped by cell after the build
+struct CellBuckets
+{
+    int* counts;                    // boids assigned to every cell, may exceed the slots
+    int* slots;                     // capacity per cell
+    int capacity = 0;               // slots per cell of the last build
+    IdPair* overflow;               // (id, cellId) of boids that found their bucket full, in arrival order
+    int* overflowRanks;             // position of every overflow entry among the overflow of its cell
+    unsigned int* overflowCount;    // shared, entries in overflow
+    unsigned int* spilled;          // overflow entries per cell
+    unsigned int* overflowStart;    // first entry of every cell in overflowIds
+    int* overflowIds;               // overflowed boids grouped by cell, counts[cell] - capacity of them per cell
+    unsigned long long frames = 0;  // builds so far
+    unsigned long long overflowFrames = 0;  // builds with at least one overflowed boid
+    unsigned long long overflowBoids = 0;   // overflowed boids summed over the builds
+};
+
+namespace
+{
+    CellBuckets AllocateCellBuckets(sycl::queue& q)
+    {
+        CellBuckets buckets;
+        buckets.counts = (int*)sycl::malloc_device(kCellTableCapacity * sizeof(int), q);
+        buckets.slots = (int*)sycl::malloc_device(kCellBucketPool * sizeof(int), q);
+        buckets.overflow = (IdPair*)sycl::malloc_device(kUnitCount * sizeof(IdPair), q);
+        buckets.overflowRanks = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        buckets.overflowCount = (unsigned int*)sycl::malloc_shared(sizeof(unsigned int), q);
+        buckets.spilled = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        buckets.overflowStart = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        buckets.overflowIds = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        *buckets.overflowCount = 0;
+        return buckets;
+    }
+
+    void FreeCellBuckets(sycl::queue& q, CellBuckets& buckets)
+    {
+        sycl::free(buckets.counts, q);
+        sycl::free(buckets.slots, q);
+        sycl::free(buckets.overflow, q);
+        sycl::free(buckets.overflowRanks, q);
+        sycl::free(buckets.overflowCount, q);
+        sycl::free(buckets.spilled, q);
+        sycl::free(buckets.overflowStart, q);
+        sycl::free(buckets.overflowIds, q);
+    }
+
+    // Slots per cell, kCellBucketHeadroom times the mean boids per window cell as far as the pool allows
+    int CellBucketCapacity(const GridLayout& layout)
+    {
+        int cells = layout.cols * layout.rows;
+        int capacity = kCellBucketHeadroom * (int)((kUnitCount + cells - 1) / cells);
+        int fits = kCellBucketPool / layout.tableSize;
+        return capacity < fits ? capacity : fits;
+    }
+
+    // Drops every boid into the next free slot of its cell with one atomic increment, no sorting or scan.
+    // Boids that find their bucket full are appended to the overflow list, which is then grouped by cell
+    // with a scan over the spill of every cell so a cell only visits its own overflow.
+    void BuildCellBuckets(sycl::queue& q, const IdPair* particlesGrid, CellBuckets& buckets, const GridLayout& layout, SortScratch& scratch)
+    {
+        int tableSize = layout.tableSize;
+        int capacity = CellBucketCapacity(layout);
+        int* counts = buckets.counts;
+        int* slots = buckets.slots;
+        IdPair* overflow = buckets.overflow;
+        int* overflowRanks = buckets.overflowRanks;
+        unsigned int* overflowCount = buckets.overflowCount;
+        unsigned int* spilled = buckets.spilled;
+        unsigned int* overflowStart = buckets.overflowStart;
+        int* overflowIds = buckets.overflowIds;
+
+        q.memset(counts, 0, tableSize * sizeof(int));
+        *overflowCount = 0;
+        q.wait();
+        q.parallel_for(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> i) {
+            int cellId = particlesGrid[i].cellId;
+            sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                sycl::access::address_space::global_space> count(counts[cellId]);
+            int slot = count.fetch_add(1);
+            if (slot < capacity)
+            {
+                slots[cellId * capacity + slot] = i;
+                return;
+            }
+            sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                sycl::access::address_space::global_space> overflowed(*overflowCount);
+            unsigned int entry = overflowed.fetch_add(1u);
+            overflow[entry] = particlesGrid[i];
+            overflowRanks[entry] = slot - capacity;
+            }).wait();
+
+        unsigned int overflowed = *overflowCount;
+        if (overflowed > 0)
+        {
+            q.parallel_for(sycl::range<1>{ (size_t)tableSize }, [=](sycl::id<1> c) {
+                spilled[c] = counts[c] > capacity ? counts[c] - capacity : 0;
+                }).wait();
+            ExclusiveScan(q, spilled, overflowStart, tableSize, scratch);
+            q.parallel_for(sycl::range<1>{ (size_t)overflowed }, [=](sycl::id<1> k) {
+                overflowIds[overflowStart[overflow[k].cellId] + overflowRanks[k]] = overflow[k].id;
+                }).wait();
+        }
+
+        buckets.capacity = capacity;
+        buckets.frames++;
+        buckets.overflowFrames += *overflowCount > 0;
+        buckets.overflowBoids += *overflowCount;
+    }
+
+    // Prints how often the overflow path was taken
+    void ReportCellBuckets(const CellBuckets& buckets)
+    {
+        if (buckets.frames == 0)
+            return;
+        printf("Cell buckets: %d slots per cell, overflow in %llu of %llu frames, %.3f%% of boids overflowed\n", buckets.capacity,
+            buckets.overflowFrames, buckets.frames, 100.0 * buckets.overflowBoids / ((double)buckets.frames * kUnitCount));
+    }
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef CELL_ORDER_H
+#define CELL_ORDER_H
+#include <CL/sycl.hpp>
+#include "constants.h"
+#include "settings.h"
+
+// Runtime shape of the grid and linearisation of its cells
+struct GridLayout
+{
+    CellOrdering ordering;
+    int divisions;      // cells per kVisualRange, the stencil reaches this many cells each way
+    float cellSize;
+    int cols;
+    int rows;
+    int ghosts;         // ring of permanently empty cells around a bounded grid, as wide as the stencil reach
+    int side;           // enclosing power-of-two square of the Morton and Hilbert orders, ghost cells included
+    int tableSize;      // number of cell ids, at most kCellTableCapacity
+    bool hashed;        // unbounded cell coordinates hashed into tableSize buckets, a bucket may hold several cells
+};
+
+namespace
+{
+    // Interleaves the low 16 bits of x and y, x in the even bits
+    inline unsigned int MortonCode(unsigned int x, unsigned int y)
+    {
+        auto spread = [](unsigned int v) {
+            v &= 0x0000FFFF;
+            v = (v | (v << 8)) & 0x00FF00FF;
+            v = (v | (v << 4)) & 0x0F0F0F0F;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    // Distance of (x, y) along the Hilbert curve filling a side x side square, side is a power of two
+    inline unsigned int HilbertCode(unsigned int side, unsigned int x, unsigned int y)
+    {
+        unsigned int d = 0;
+        for (unsigned int s = side / 2; s > 0; s /= 2)
+        {
+            unsigned int rx = (x & s) > 0;
+            unsigned int ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                unsigned int t = x;
+                x = y;
+                y = t;
+            }
+        }
+        return d;
+    }
+
+    // Linear id of cell (col, row) in a grid of cols columns enclosed by a side x side power-of-two square
+    inline int LinearCellId(CellOrdering ordering, int col, int row, int cols, int side)
+    {
+        switch (ordering)
+        {
+        case CellOrdering::Morton:
+            return MortonCode(col, row);
+        case CellOrdering::Hilbert:
+            return HilbertCode(side, col, row);
+        default:
+            return col + row * cols;
+        }
+    }
+
+    // Spreads unbounded cell coordinates over a power-of-two table
+    inline int HashCellId(int col, int row, int tableSize)
+    {
+        return (int)(((unsigned int)col * 73856093u) ^ ((unsigned int)row * 19349663u)) & (tableSize - 1);
+    }
+
+    // Grid of cells kVisualRange / divisions wide, a neighbor within kVisualRange is at most divisions cells away.
+    // A hashed grid covers the whole plane, a bounded one covers the window plus a ring of ghost cells that no
+    // boid is ever assigned to, so the stencil of any window cell stays inside the grid without bounds checks.
+    GridLayout MakeGridLayout(CellOrdering ordering, int divisions, bool hashed)
+    {
+        GridLayout layout;
+        layout.ordering = ordering;
+        layout.divisions = divisions;
+        layout.cellSize = kVisualRange / divisions;
+        layout.cols = kGridColsNum * divisions;
+        layout.rows = kGridRowsNum * divisions;
+        layout.ghosts = hashed ? 0 : divisions;
+        int paddedCols = layout.cols + 2 * layout.ghosts;
+        int paddedRows = layout.rows + 2 * layout.ghosts;
+        layout.side = CeilPowerOfTwo(paddedCols > paddedRows ? paddedCols : paddedRows);
+        layout.tableSize = ordering == CellOrdering::RowMajor ? paddedCols * paddedRows : layout.side * layout.side;
+        layout.hashed = hashed;
+        if (hashed)
+            layout.tableSize = kHashTableSize;
+        return layout;
+    }
+
+    // Cell containing the point (x, y). Bounded grids clamp boids outside the window into the border cells,
+    // clamping moves cells closer together so the stencil still reaches every neighbor.
+    inline void CellCoordinates(const GridLayout& layout, float x, float y, int& col, int& row)
+    {
+        col = (int)sycl::floor(x / layout.cellSize);
+        row = (int)sycl::floor(y / layout.cellSize);
+        if (layout.hashed)
+            return;
+        col = col < 0 ? 0 : (col >= layout.cols ? layout.cols - 1 : col);
+        row = row < 0 ? 0 : (row >= layout.rows ? layout.rows - 1 : row);
+    }
+
+    // Cells beyond the ghost ring of a bounded grid have no id
+    inline bool CellInGrid(const GridLayout& layout, int col, int row)
+    {
+        return layout.hashed || (col >= -layout.ghosts && col < layout.cols + layout.ghosts &&
+            row >= -layout.ghosts && row < layout.rows + layout.ghosts);
+    }
+
+    // Window cells are (0, 0) to (cols - 1, rows - 1), ghost cells surround them
+    inline int CellId(const GridLayout& layout, int col, int row)
+    {
+        if (layout.hashed)
+            return HashCellId(col, row, layout.tableSize);
+        return LinearCellId(layout.ordering, col + layout.ghosts, row + layout.ghosts, layout.cols + 2 * layout.ghosts, layout.side);
+    }
+
+    // Id of the cell containing the point (x, y)
+    inline int CellIdAt(const GridLayout& layout, float x, float y)
+    {
+        int col, row;
+        CellCoordinates(layout, x, y, col, row);
+        return CellId(layout, col, row);
+    }
+}
+#endif
@@ -0,0 +1,86 @@
+#ifndef CELL_SIZE_TUNER_H
+#define CELL_SIZE_TUNER_H
+#include <CL/sycl.hpp>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include "boids.h"
+#include "cell_order.h"
+#include "settings.h"
+
+namespace
+{
+    constexpr int kTunerWarmupFrames = 2;
+    constexpr int kTunerFrames = 10;
+
+    // Average number of boids in the stencil cells of every boid, the distance tests one step makes
+    double CandidatesPerBoid(const Boids& boids, const GridLayout& layout)
+    {
+        std::vector<unsigned int> cellCounts(layout.tableSize, 0);
+        for (size_t i = 0; i < kUnitCount; i++)
+            cellCounts[CellIdAt(layout, boids.positions.x[i], boids.positions.y[i])]++;
+
+        double candidates = 0.0;
+        for (size_t i = 0; i < kUnitCount; i++)
+        {
+            int col, row;
+            CellCoordinates(layout, boids.positions.x[i], boids.positions.y[i], col, row);
+            for (int r = row - layout.divisions; r <= row + layout.divisions; r++)
+                for (int c = col - layout.divisions; c <= col + layout.divisions; c++)
+                    if (CellInGrid(layout, c, r))
+                        candidates += cellCounts[CellId(layout, c, r)];
+        }
+        return candidates / kUnitCount;
+    }
+
+    // Smaller cells test fewer candidates but scan more cells, the best size depends on density and device.
+    // Runs a few frames with every cell division from the current flock, restores the flock after each trial
+    // and returns the fastest division. renderFrame(settings) renders one frame, resetState() drops state
+    // carried between frames (incremental grid, neighbor lists) that no longer matches the restored flock.
+    template <typename FrameFunc, typename ResetFunc>
+    int TuneCellDivisions(sycl::queue& q, const Settings& settings, Boids* boids, FrameFunc renderFrame, ResetFunc resetState)
+    {
+        Boids* snapshot = (Boids*)sycl::malloc_device(sizeof(Boids), q);
+        std::unique_ptr<Boids> hostBoids(new Boids);
+        q.memcpy(snapshot, boids, sizeof(Boids));
+        q.memcpy(hostBoids.get(), boids, sizeof(Boids));
+        q.wait();
+
+        printf("Cell size tuner: %d warm-up and %d timed frames per cell size\n", kTunerWarmupFrames, kTunerFrames);
+        printf("%-10s %12s %18s %10s\n", "divisions", "cell size", "candidates/boid", "ms/frame");
+
+        int best = 1;
+        double bestMilliseconds = 0.0;
+        for (int divisions = 1; divisions <= kMaxCellDivisions; divisions++)
+        {
+            Settings trial = settings;
+            trial.cellDivisions = divisions;
+            GridLayout layout = MakeGridLayout(settings.cellOrdering, divisions, settings.gridMethod == GridMethod::Hash);
+
+            resetState();
+            for (int frame = 0; frame < kTunerWarmupFrames; frame++)
+                renderFrame(trial);
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < kTunerFrames; frame++)
+                renderFrame(trial);
+            q.wait();
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / kTunerFrames;
+
+            printf("%-10d %12.1f %18.1f %10.3f\n", divisions, layout.cellSize, CandidatesPerBoid(*hostBoids, layout), milliseconds);
+            if (divisions == 1 || milliseconds < bestMilliseconds)
+            {
+                best = divisions;
+                bestMilliseconds = milliseconds;
+            }
+
+            q.memcpy(boids, snapshot, sizeof(Boids)).wait();
+        }
+        resetState();
+        printf("Using cells of kVisualRange / %d\n", best);
+
+        sycl::free(snapshot, q);
+        return best;
+    }
+}
+#endif
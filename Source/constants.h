@@ -9,6 +9,13 @@ namespace
 	{
 		return (int)log2(number) + 1;
 	}
+	constexpr int CeilPowerOfTwo(int number)
+	{
+		int power = 1;
+		while (power < number)
+			power *= 2;
+		return power;
+	}
 	constexpr float kVisualRange = 100.0f;
 	constexpr float kProtectedRange = 20.0f;
 
@@ -27,6 +34,20 @@ namespace
 	constexpr int   kGridColsNum = (kWindowWidth / kVisualRange);
 	constexpr int   kGridRowsNum = (kWindowHeight / kVisualRange);
 	constexpr int   kCellsNumTotal = kGridColsNum * kGridRowsNum;
+	// Cells may be kVisualRange / k wide for k up to kMaxCellDivisions, scanned with a (2k+1)x(2k+1) stencil
+	constexpr int   kMaxCellDivisions = 4;
+	// Morton and Hilbert ids live on the enclosing power-of-two square, cell tables are sized for the finest grid
+	// and its ring of ghost cells
+	constexpr int   kMaxGridSidePow2 = CeilPowerOfTwo((kGridColsNum > kGridRowsNum ? kGridColsNum : kGridRowsNum) * kMaxCellDivisions + 2 * kMaxCellDivisions);
+	constexpr int   kMaxCellTableSize = kMaxGridSidePow2 * kMaxGridSidePow2;
+	// Topological mode follows at most this many nearest neighbors
+	constexpr int   kMaxNearestNeighbors = 16;
+	// Spatial hash buckets, proportional to the boid count instead of the world area
+	constexpr int   kHashTableSize = CeilPowerOfTwo(2 * kUnitCount);
+	constexpr int   kCellTableCapacity = kHashTableSize > kMaxCellTableSize ? kHashTableSize : kMaxCellTableSize;
+	// Bucket grid cells get kCellBucketHeadroom times the mean boids per cell in slots, from a pool of kCellBucketPool
+	constexpr int   kCellBucketHeadroom = 4;
+	constexpr int   kCellBucketPool = kCellTableCapacity * 16;
 
 	constexpr float kMarginSize = 200.0f;
 	constexpr float kLeftMarginSize = kMarginSize;
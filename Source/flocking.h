@@ -0,0 +1,412 @@
+#ifndef FLOCKING_H
+#define FLOCKING_H
+#include <CL/sycl.hpp>
+#include <cmath>
+#include <type_traits>
+#include <optional>
+#include <vector>
+#include "boids.h"
+#include "settings.h"
+
+// Sums gathered from the neighbors of one boid
+struct Neighborhood
+{
+    float xAvoid = 0.0f;
+    float yAvoid = 0.0f;
+
+    float vxAvg = 0.0f;
+    float vyAvg = 0.0f;
+
+    float xAvg = 0.0f;
+    float yAvg = 0.0f;
+
+    unsigned int neighbors = 0;
+};
+
+// Compile-time copy of FlockingRules, disabled rules leave no branch in the kernel
+template <bool FastMath, bool MouseAvoidance, bool Wrap, bool SpeedClamp>
+struct RuleSet
+{
+    static constexpr bool fastMath = FastMath;
+    static constexpr bool mouseAvoidance = MouseAvoidance;
+    static constexpr bool wrap = Wrap;
+    static constexpr bool speedClamp = SpeedClamp;
+};
+
+// Launch sites of the flocking kernels, every site is compiled once per rule set as FlockingKernel<Site, Rules>
+class GatherSite;
+class ListSite;
+class LbvhSite;
+class SweepSite;
+class FusedSite;
+class NearestGridSite;
+class NearestLbvhSite;
+class NearestSweepSite;
+class SymmetricSite;
+class TiledSite;
+class SubGroupSite;
+template <typename Site, typename Rules>
+class FlockingKernel;
+
+template <typename... Sites>
+struct SiteList {};
+using FlockingSites = SiteList<GatherSite, ListSite, LbvhSite, SweepSite, FusedSite, NearestGridSite, NearestLbvhSite,
+    NearestSweepSite, SymmetricSite, TiledSite, SubGroupSite>;
+
+namespace
+{
+    inline float Distance(float x1, float y1, float x2, float y2)
+    {
+        return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+    }
+
+    // Calls next(std::true_type) when flag is set, next(std::false_type) otherwise
+    template <typename NextFunc>
+    void DispatchFlag(bool flag, NextFunc next)
+    {
+        if (flag)
+            next(std::true_type{});
+        else
+            next(std::false_type{});
+    }
+
+    // Calls run(RuleSet<...>) with the instantiation matching rules
+    template <typename RunFunc>
+    void DispatchRules(const FlockingRules& rules, RunFunc run)
+    {
+        DispatchFlag(rules.fastMath, [&](auto fast) {
+            DispatchFlag(rules.mouseAvoidance, [&](auto mouse) {
+                DispatchFlag(rules.wrap, [&](auto wrap) {
+                    DispatchFlag(rules.speedClamp, [&](auto clamp) {
+                        run(RuleSet<decltype(fast)::value, decltype(mouse)::value, decltype(wrap)::value, decltype(clamp)::value>{});
+                        });
+                    });
+                });
+            });
+    }
+
+    // Flocking parameters as specialization constants, the defaults are the compile-time values
+    constexpr sycl::specialization_id<float> kTurnFactorId(kTurnFactor);
+    constexpr sycl::specialization_id<float> kCenteringFactorId(kCenteringFactor);
+    constexpr sycl::specialization_id<float> kAvoidFactorId(kAvoidFactor);
+    constexpr sycl::specialization_id<float> kAlignFactorId(kAlignFactor);
+    constexpr sycl::specialization_id<float> kMaxSpeedId(kMaxSpeed);
+    constexpr sycl::specialization_id<float> kMinSpeedId(kMinSpeed);
+    constexpr sycl::specialization_id<float> kMouseFactorId(kMouseFactor);
+
+    // Parameters the running kernel was specialized with, the JIT folds them like constants
+    inline FlockingParameters SpecializedParameters(const sycl::kernel_handler& kh)
+    {
+        FlockingParameters parameters;
+        parameters.turnFactor = kh.get_specialization_constant<kTurnFactorId>();
+        parameters.centeringFactor = kh.get_specialization_constant<kCenteringFactorId>();
+        parameters.avoidFactor = kh.get_specialization_constant<kAvoidFactorId>();
+        parameters.alignFactor = kh.get_specialization_constant<kAlignFactorId>();
+        parameters.maxSpeed = kh.get_specialization_constant<kMaxSpeedId>();
+        parameters.minSpeed = kh.get_specialization_constant<kMinSpeedId>();
+        parameters.mouseFactor = kh.get_specialization_constant<kMouseFactorId>();
+        return parameters;
+    }
+
+}
+
+// The flocking kernels of one queue and their bundle specialized for the last parameters. Building the
+// bundle compiles them again, so it is kept and only rebuilt when a parameter differs from the last build.
+class FlockingKernels
+{
+public:
+    explicit FlockingKernels(sycl::queue& q)
+        : q(q)
+    {
+        for (int combination = 0; combination < 16; combination++)
+        {
+            FlockingRules rules;
+            rules.fastMath = combination & 1;
+            rules.mouseAvoidance = combination & 2;
+            rules.wrap = combination & 4;
+            rules.speedClamp = combination & 8;
+            DispatchRules(rules, [&](auto ruleSet) { AddIds<decltype(ruleSet)>(FlockingSites{}); });
+        }
+    }
+
+    // Submits a flocking kernel, submit(h) launches it. The default parameters are the defaults of the
+    // specialization constants, so only other values need the specialized bundle.
+    template <typename SubmitFunc>
+    sycl::event Submit(const FlockingParameters& parameters, SubmitFunc submit)
+    {
+        if (parameters == FlockingParameters{})
+            return q.submit(submit);
+        const auto& kernels = Specialized(parameters);
+        return q.submit([&](sycl::handler& h) {
+            h.use_kernel_bundle(kernels);
+            submit(h);
+            });
+    }
+
+private:
+    // Keeps the kernels of every site for Rules that the device can run
+    template <typename Rules, typename... Sites>
+    void AddIds(SiteList<Sites...>)
+    {
+        for (sycl::kernel_id id : { sycl::get_kernel_id<FlockingKernel<Sites, Rules>>()... })
+            if (sycl::is_compatible({ id }, q.get_device()))
+                ids.push_back(id);
+    }
+
+    const sycl::kernel_bundle<sycl::bundle_state::executable>& Specialized(const FlockingParameters& parameters)
+    {
+        if (bundle && parameters == specialized)
+            return *bundle;
+
+        auto input = sycl::get_kernel_bundle<sycl::bundle_state::input>(q.get_context(), ids);
+        input.set_specialization_constant<kTurnFactorId>(parameters.turnFactor);
+        input.set_specialization_constant<kCenteringFactorId>(parameters.centeringFactor);
+        input.set_specialization_constant<kAvoidFactorId>(parameters.avoidFactor);
+        input.set_specialization_constant<kAlignFactorId>(parameters.alignFactor);
+        input.set_specialization_constant<kMaxSpeedId>(parameters.maxSpeed);
+        input.set_specialization_constant<kMinSpeedId>(parameters.minSpeed);
+        input.set_specialization_constant<kMouseFactorId>(parameters.mouseFactor);
+        bundle = sycl::build(input);
+        specialized = parameters;
+        return *bundle;
+    }
+
+    sycl::queue& q;
+    std::vector<sycl::kernel_id> ids;   // flocking kernels the device can run
+    std::optional<sycl::kernel_bundle<sycl::bundle_state::executable>> bundle;
+    FlockingParameters specialized;
+};
+
+namespace
+{
+    // Distances are compared squared in the fast variant, as square roots in the exact one.
+    // RangeMeasure(squared distance) is tested against RangeLimit(range).
+    template <bool FastMath>
+    inline float RangeMeasure(float distanceSquared)
+    {
+        if constexpr (FastMath)
+            return distanceSquared;
+        else
+            return sqrt(distanceSquared);
+    }
+
+    template <bool FastMath>
+    inline float RangeLimit(float range)
+    {
+        if constexpr (FastMath)
+            return range * range;
+        else
+            return range;
+    }
+
+    // Adds a neighbor at (xFriend, yFriend) to the neighborhood of the boid at (x, y), avoided when it is within kProtectedRange
+    inline void AddNeighborState(Neighborhood& neighborhood, float x, float y, float xFriend, float yFriend,
+        float xFriendVelocity, float yFriendVelocity, bool avoid)
+    {
+        if (avoid)
+        {
+            neighborhood.xAvoid += x - xFriend;
+            neighborhood.yAvoid += y - yFriend;
+            return;
+        }
+        neighborhood.neighbors++;
+        neighborhood.vxAvg += xFriendVelocity;
+        neighborhood.vyAvg += yFriendVelocity;
+        neighborhood.xAvg += xFriend;
+        neighborhood.yAvg += yFriend;
+    }
+
+    // Adds boid j to the neighborhood of the boid at (x, y), avoided when it is within kProtectedRange
+    inline void AddNeighborAt(Neighborhood& neighborhood, const Boids* boids, float x, float y, int j, bool avoid)
+    {
+        AddNeighborState(neighborhood, x, y, boids->positions.x[j], boids->positions.y[j],
+            boids->velocities.vx[j], boids->velocities.vy[j], avoid);
+    }
+
+    // Adds boid j to the neighborhood of the boid at (x, y) when it is within kVisualRange
+    template <bool FastMath>
+    inline void AddNeighbor(Neighborhood& neighborhood, const Boids* boids, float x, float y, int j)
+    {
+        float dx = boids->positions.x[j] - x;
+        float dy = boids->positions.y[j] - y;
+        float measure = RangeMeasure<FastMath>(dx * dx + dy * dy);
+        if (measure > RangeLimit<FastMath>(kVisualRange))
+            return;
+        AddNeighborAt(neighborhood, boids, x, y, j, measure < RangeLimit<FastMath>(kProtectedRange));
+    }
+
+    // Applies the flocking rules enabled in Rules to boid i and writes its new state to the temporary buffers.
+    // The fast variant clamps the speed and scales the triangle with rsqrt.
+    template <typename Rules>
+    inline void UpdateBoid(Boids* boids, int i, Neighborhood neighborhood, const FlockingParameters& parameters, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities)
+    {
+        float x = boids->positions.x[i];
+        float y = boids->positions.y[i];
+        float vx = boids->velocities.vx[i];
+        float vy = boids->velocities.vy[i];
+
+        constexpr bool FastMath = Rules::fastMath;
+
+        // Mouse pointer avoiding
+        if constexpr (Rules::mouseAvoidance)
+        {
+            int xMouse = mousePointer->x;
+            int yMouse = mousePointer->y;
+            int xMouseAvoid = 0;
+            int yMouseAvoid = 0;
+            float pointerDistance = RangeMeasure<FastMath>((x - xMouse) * (x - xMouse) + (y - yMouse) * (y - yMouse));
+
+            if (pointerDistance < RangeLimit<FastMath>(kVisualRange))
+            {
+                xMouseAvoid = x - xMouse;
+                yMouseAvoid = y - yMouse;
+            }
+            vx += xMouseAvoid * parameters.mouseFactor;
+            vy += yMouseAvoid * parameters.mouseFactor;
+        }
+
+        unsigned int neighbors = neighborhood.neighbors;
+        if (neighbors > 0)
+        {
+            // Alignment
+            float vxAvg = neighborhood.vxAvg / neighbors;
+            float vyAvg = neighborhood.vyAvg / neighbors;
+            vx += (vxAvg - vx) * parameters.alignFactor;
+            vy += (vyAvg - vy) * parameters.alignFactor;
+
+            // Cohesion
+            float xAvg = neighborhood.xAvg / neighbors;
+            float yAvg = neighborhood.yAvg / neighbors;
+            vx += (xAvg - x) * parameters.centeringFactor;
+            vy += (yAvg - y) * parameters.centeringFactor;
+        }
+
+        // Separation
+        vx += neighborhood.xAvoid * parameters.avoidFactor;
+        vy += neighborhood.yAvoid * parameters.avoidFactor;
+
+
+        // Margin
+        if constexpr (!Rules::wrap)
+        {
+            if (x < kLeftMarginSize)
+                vx += parameters.turnFactor;
+            else if (x > kRightMarginSize)
+                vx -= parameters.turnFactor;
+            if (y < kBottomMarginSize)
+                vy += parameters.turnFactor;
+            else if (y > kTopMarginSize)
+                vy -= parameters.turnFactor;
+        }
+
+        // Speed limit
+        float xVelocity = -boids->velocities.vy[i];
+        float yVelocity = boids->velocities.vx[i];
+        float scale;
+        if constexpr (FastMath)
+        {
+            if constexpr (Rules::speedClamp)
+            {
+                float speedSquared = vx * vx + vy * vy;
+                float inverseSpeed = sycl::rsqrt(speedSquared);
+                if (speedSquared > parameters.maxSpeed * parameters.maxSpeed)
+                {
+                    vx *= inverseSpeed * parameters.maxSpeed;
+                    vy *= inverseSpeed * parameters.maxSpeed;
+                }
+                else if (speedSquared < parameters.minSpeed * parameters.minSpeed)
+                {
+                    vx *= inverseSpeed * parameters.minSpeed;
+                    vy *= inverseSpeed * parameters.minSpeed;
+                }
+            }
+            scale = 2 * sycl::rsqrt(xVelocity * xVelocity + yVelocity * yVelocity);
+        }
+        else
+        {
+            if constexpr (Rules::speedClamp)
+            {
+                float speed = sqrt(vx * vx + vy * vy);
+                if (speed > parameters.maxSpeed)
+                {
+                    vx = vx / speed * parameters.maxSpeed;
+                    vy = vy / speed * parameters.maxSpeed;
+                }
+
+                if (speed < parameters.minSpeed)
+                {
+                    vx = vx / speed * parameters.minSpeed;
+                    vy = vy / speed * parameters.minSpeed;
+                }
+            }
+            scale = 2 / sqrt(xVelocity * xVelocity + yVelocity * yVelocity);
+        }
+        xVelocity *= scale;
+        yVelocity *= scale;
+
+        float xNew = x + vx;
+        float yNew = y + vy;
+
+        // Wrap around the window edges, neighbors are still searched without wrapping
+        if constexpr (Rules::wrap)
+        {
+            xNew -= sycl::floor(xNew / kWindowWidth) * kWindowWidth;
+            yNew -= sycl::floor(yNew / kWindowHeight) * kWindowHeight;
+        }
+
+        // Write velocity and position to temporary buffer
+        temporaryVelocities->vx[i] = vx;
+        temporaryVelocities->vy[i] = vy;
+        temporaryPositions->x[i] = xNew;
+        temporaryPositions->y[i] = yNew;
+
+        // Triangle positions can be updated safely, they keep the external order for rendering
+        TrianglePositions& triangle = boids->trianglePositions[boids->ids[i]];
+        triangle.p1.x = xNew + xVelocity;
+        triangle.p1.y = yNew + yVelocity;
+        triangle.p2.x = xNew - xVelocity;
+        triangle.p2.y = yNew - yVelocity;
+        triangle.p3.x = xNew + vx * scale * 2.5;
+        triangle.p3.y = yNew + vy * scale * 2.5;
+    }
+
+    // Submits the flocking rules for every boid with the kernel instantiated for rules, without waiting.
+    // forEachNeighbor(i, visit) calls visit(j) for every candidate neighbor j of boid i,
+    // candidates farther than kVisualRange are rejected by AddNeighbor.
+    // updated(i) runs in the same work-item once the new state of boid i is in the temporary buffers.
+    template <typename Site, typename NeighborFunc, typename UpdatedFunc>
+    sycl::event SubmitFlockingStep(FlockingKernels& kernels, Boids* boids, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules, NeighborFunc forEachNeighbor, UpdatedFunc updated)
+    {
+        sycl::event done;
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            done = kernels.Submit(rules.parameters, [&](sycl::handler& h) {
+                h.parallel_for<FlockingKernel<Site, Rules>>(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> id, sycl::kernel_handler kh) {
+                    int i = id;
+                    float x = boids->positions.x[i];
+                    float y = boids->positions.y[i];
+                    Neighborhood neighborhood;
+                    forEachNeighbor(i, [&](int j) {
+                        if (j != i)
+                            AddNeighbor<FastMath>(neighborhood, boids, x, y, j);
+                        });
+                    UpdateBoid<Rules>(boids, i, neighborhood, SpecializedParameters(kh), mousePointer, temporaryPositions, temporaryVelocities);
+                    updated(i);
+                    });
+                });
+            });
+        return done;
+    }
+
+    // Runs the flocking rules for every boid and waits for them
+    template <typename Site, typename NeighborFunc>
+    void FlockingStep(FlockingKernels& kernels, Boids* boids, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules, NeighborFunc forEachNeighbor)
+    {
+        SubmitFlockingStep<Site>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, rules, forEachNeighbor, [](int) {}).wait();
+    }
+}
+#endif
@@ -0,0 +1,157 @@
+#ifndef FUSED_FRAME_H
+#define FUSED_FRAME_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "flocking.h"
+#include "radix_sort.h"
+#include "settings.h"
+#include "spatial_grid.h"
+
+// Counting grid binned at the end of the previous frame. The flocking kernel assigns the new cell of
+// every boid and counts it, so a frame is flocking, one scan and one scatter that also copies the new
+// state back, with a single wait.
+struct FusedGrid
+{
+    int* cellIds;               // cell of every boid after the last integration
+    int* ranks;                 // slot of every boid within its cell
+    unsigned int* counts;       // boids per cell, zero again once binned
+    unsigned int* cellStart;
+    unsigned int* cellEnd;
+    IdPair* binned;             // boids grouped by cell, cellStart/cellEnd bound every cell
+    GridLayout layout;
+    bool valid = false;         // binned from the current positions with layout
+};
+
+namespace
+{
+    FusedGrid AllocateFusedGrid(sycl::queue& q)
+    {
+        FusedGrid fused;
+        fused.cellIds = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        fused.ranks = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        fused.counts = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        fused.cellStart = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        fused.cellEnd = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        fused.binned = (IdPair*)sycl::malloc_device(kUnitCount * sizeof(IdPair), q);
+        return fused;
+    }
+
+    void FreeFusedGrid(sycl::queue& q, FusedGrid& fused)
+    {
+        sycl::free(fused.cellIds, q);
+        sycl::free(fused.ranks, q);
+        sycl::free(fused.counts, q);
+        sycl::free(fused.cellStart, q);
+        sycl::free(fused.cellEnd, q);
+        sycl::free(fused.binned, q);
+    }
+
+    // Gather flocking over a counting or hash grid, without lists, topological mode, reordering or culling
+    bool FusedFrameApplies(const Settings& settings)
+    {
+        return (settings.gridMethod == GridMethod::Counting || settings.gridMethod == GridMethod::Hash)
+            && settings.flockingMethod == FlockingMethod::Gather && settings.neighborSkin == 0.0f
+            && settings.nearestNeighbors == 0 && settings.reorderInterval == 0 && !settings.cellCulling;
+    }
+
+    bool SameLayout(const GridLayout& a, const GridLayout& b)
+    {
+        return a.ordering == b.ordering && a.divisions == b.divisions && a.hashed == b.hashed && a.tableSize == b.tableSize;
+    }
+
+    // Adds boid i at (x, y) to the counts of its cell
+    inline void AssignCell(const FusedGrid& fused, int i, float x, float y)
+    {
+        int cell = CellIdAt(fused.layout, x, y);
+        sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+            sycl::access::address_space::global_space> count(fused.counts[cell]);
+        fused.cellIds[i] = cell;
+        fused.ranks[i] = count.fetch_add(1u);
+    }
+
+    // Scans the counts into cellStart and scatters every boid into its cell slot once counted is done.
+    // The scatter also closes every cell, clears the counts for the next frame and, given boids, copies
+    // the temporary state back.
+    sycl::event SubmitFusedBinning(sycl::queue& q, const FusedGrid& fused, sycl::event counted,
+        Boids* boids, const Positions* temporaryPositions, const Velocities* temporaryVelocities)
+    {
+        int tableSize = fused.layout.tableSize;
+        unsigned int* counts = fused.counts;
+        unsigned int* cellStart = fused.cellStart;
+        unsigned int* cellEnd = fused.cellEnd;
+        const int* cellIds = fused.cellIds;
+        const int* ranks = fused.ranks;
+        IdPair* binned = fused.binned;
+
+        // One work-group scans the whole table, no block sums to combine
+        sycl::event scanned = q.submit([&](sycl::handler& h) {
+            h.depends_on(counted);
+            h.parallel_for(sycl::nd_range<1>{ sycl::range<1>(kSortBlockSize), sycl::range<1>(kSortBlockSize) }, [=](sycl::nd_item<1> it) {
+                sycl::joint_exclusive_scan(it.get_group(), counts, counts + tableSize, cellStart, 0u, sycl::plus<unsigned int>());
+                });
+            });
+
+        size_t items = kUnitCount > (size_t)tableSize ? kUnitCount : (size_t)tableSize;
+        return q.submit([&](sycl::handler& h) {
+            h.depends_on(scanned);
+            h.parallel_for(sycl::range<1>{ items }, [=](sycl::id<1> id) {
+                int k = id;
+                if (k < kUnitCount)
+                {
+                    binned[cellStart[cellIds[k]] + ranks[k]] = IdPair{ k, cellIds[k] };
+                    if (boids != nullptr)
+                    {
+                        boids->positions.x[k] = temporaryPositions->x[k];
+                        boids->positions.y[k] = temporaryPositions->y[k];
+                        boids->velocities.vx[k] = temporaryVelocities->vx[k];
+                        boids->velocities.vy[k] = temporaryVelocities->vy[k];
+                    }
+                }
+                if (k < tableSize)
+                {
+                    cellEnd[k] = cellStart[k] + counts[k];
+                    counts[k] = 0;
+                }
+                });
+            });
+    }
+
+    // Bins the current positions when the fused grid does not hold them yet
+    void BinFusedGrid(sycl::queue& q, const Settings& settings, const Boids* boids, FusedGrid& fused)
+    {
+        GridLayout layout = MakeGridLayout(settings.cellOrdering, settings.cellDivisions, settings.gridMethod == GridMethod::Hash);
+        if (fused.valid && SameLayout(fused.layout, layout))
+            return;
+        fused.layout = layout;
+        q.memset(fused.counts, 0, layout.tableSize * sizeof(unsigned int)).wait();
+
+        sycl::event counted = q.parallel_for(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> id) {
+            int i = id;
+            AssignCell(fused, i, boids->positions.x[i], boids->positions.y[i]);
+            });
+        SubmitFusedBinning(q, fused, counted, nullptr, nullptr, nullptr).wait();
+        fused.valid = true;
+    }
+
+    // One frame as three launches: gather flocking over the fused grid that also assigns and counts the
+    // new cells, the scan, and the scatter with the copy-back. Only the end of the frame waits.
+    void FusedFrame(sycl::queue& q, FlockingKernels& kernels, const Settings& settings, Boids* boids, FusedGrid& fused, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities)
+    {
+        BinFusedGrid(q, settings, boids, fused);
+
+        GridView view{};
+        view.layout = fused.layout;
+        view.storage = CellStorage::Ranges;
+        view.groupedGrid = fused.binned;
+        view.cellStart = fused.cellStart;
+        view.cellEnd = fused.cellEnd;
+        view.bounds.valid = false;
+
+        sycl::event counted = SubmitFlockingStep<FusedSite>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, RulesOf(settings),
+            [=](int i, auto&& visit) { view.ForEachNeighbor(boids, i, kVisualRange, visit); },
+            [=](int i) { AssignCell(fused, i, temporaryPositions->x[i], temporaryPositions->y[i]); });
+        SubmitFusedBinning(q, fused, counted, boids, temporaryPositions, temporaryVelocities).wait();
+    }
+}
+#endif
@@ -0,0 +1,458 @@
+#ifndef HOST_FLOCKING_H
+#define HOST_FLOCKING_H
+#include <CL/sycl.hpp>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "boids.h"
+#include "settings.h"
+#include "cell_order.h"
+#include "flocking.h"
+#include "math_accuracy.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HOST_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Compiles one function for an instruction set the rest of the file is not built for, MSVC needs no flag
+#if defined(HOST_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define HOST_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HOST_TARGET(isa)
+#endif
+
+namespace
+{
+    constexpr float kHostTolerance = 1e-3f;   // largest position or velocity difference to the device after one frame
+    constexpr size_t kHostSlotBatch = 256;     // slots a worker thread takes at a time, clusters make batches uneven
+
+    const char* HostIsaName(HostIsa isa)
+    {
+        switch (isa)
+        {
+        case HostIsa::Avx512:
+            return "AVX-512";
+        case HostIsa::Avx2:
+            return "AVX2";
+        default:
+            return "scalar";
+        }
+    }
+
+#ifdef HOST_SIMD
+    inline void Cpuid(int leaf, int subleaf, unsigned int registers[4])
+    {
+#if defined(_MSC_VER)
+        int values[4];
+        __cpuidex(values, leaf, subleaf);
+        for (int r = 0; r < 4; r++)
+            registers[r] = values[r];
+#else
+        __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    }
+
+    // Register state the operating system saves on context switches
+    inline unsigned long long EnabledXState()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int low, high;
+        __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return ((unsigned long long)high << 32) | low;
+#endif
+    }
+#endif
+
+    // Widest instruction set both the processor and the operating system support
+    HostIsa DetectHostIsa()
+    {
+#ifdef HOST_SIMD
+        unsigned int registers[4];
+        Cpuid(0, 0, registers);
+        if (registers[0] < 7)
+            return HostIsa::Scalar;
+        Cpuid(1, 0, registers);
+        bool osSavesAvx = (registers[2] & (1u << 27)) && (registers[2] & (1u << 28)) && (EnabledXState() & 0x6) == 0x6;
+        if (!osSavesAvx)
+            return HostIsa::Scalar;
+        Cpuid(7, 0, registers);
+        if ((registers[1] & (1u << 16)) && (EnabledXState() & 0xE6) == 0xE6)
+            return HostIsa::Avx512;
+        if (registers[1] & (1u << 5))
+            return HostIsa::Avx2;
+#endif
+        return HostIsa::Scalar;
+    }
+
+    // Adds the candidates in slots begin to end to the neighborhood of the boid at (px, py). A boid finds
+    // itself at distance 0, inside kProtectedRange, where it adds nothing, so it needs no id test.
+    template <bool FastMath>
+    void GatherScalar(const float* xs, const float* ys, const float* vxs, const float* vys, unsigned int begin, unsigned int end,
+        float px, float py, Neighborhood& neighborhood)
+    {
+        for (unsigned int k = begin; k < end; k++)
+        {
+            float dx = xs[k] - px;
+            float dy = ys[k] - py;
+            float measure = RangeMeasure<FastMath>(dx * dx + dy * dy);
+            if (measure > RangeLimit<FastMath>(kVisualRange))
+                continue;
+            AddNeighborState(neighborhood, px, py, xs[k], ys[k], vxs[k], vys[k], measure < RangeLimit<FastMath>(kProtectedRange));
+        }
+    }
+
+#ifdef HOST_SIMD
+    HOST_TARGET("avx2")
+    inline float HorizontalSum(__m256 v)
+    {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+        return _mm_cvtss_f32(sum);
+    }
+
+    // GatherScalar over 8 candidates per iteration, the tail is loaded with a lane mask. Range tests
+    // produce masks that select which lanes each accumulator takes.
+    template <bool FastMath>
+    HOST_TARGET("avx2")
+    void GatherAvx2(const float* xs, const float* ys, const float* vxs, const float* vys, unsigned int begin, unsigned int end,
+        float px, float py, Neighborhood& neighborhood)
+    {
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 visual = _mm256_set1_ps(RangeLimit<FastMath>(kVisualRange));
+        const __m256 protect = _mm256_set1_ps(RangeLimit<FastMath>(kProtectedRange));
+        __m256 x = _mm256_set1_ps(px);
+        __m256 y = _mm256_set1_ps(py);
+        __m256 xAvoid = _mm256_setzero_ps(), yAvoid = _mm256_setzero_ps();
+        __m256 vxSum = _mm256_setzero_ps(), vySum = _mm256_setzero_ps();
+        __m256 xSum = _mm256_setzero_ps(), ySum = _mm256_setzero_ps();
+        __m256 count = _mm256_setzero_ps();
+        for (unsigned int k = begin; k < end; k += 8)
+        {
+            __m256i load = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(end - k)), lanes);
+            __m256 xFriend = _mm256_maskload_ps(xs + k, load);
+            __m256 yFriend = _mm256_maskload_ps(ys + k, load);
+            __m256 dx = _mm256_sub_ps(xFriend, x);
+            __m256 dy = _mm256_sub_ps(yFriend, y);
+            __m256 measure = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            if constexpr (!FastMath)
+                measure = _mm256_sqrt_ps(measure);
+            __m256 inRange = _mm256_and_ps(_mm256_castsi256_ps(load), _mm256_cmp_ps(measure, visual, _CMP_LE_OQ));
+            if (_mm256_testz_ps(inRange, inRange))
+                continue;
+            __m256 avoid = _mm256_and_ps(inRange, _mm256_cmp_ps(measure, protect, _CMP_LT_OQ));
+            __m256 flock = _mm256_andnot_ps(avoid, inRange);
+            xAvoid = _mm256_add_ps(xAvoid, _mm256_and_ps(avoid, _mm256_sub_ps(x, xFriend)));
+            yAvoid = _mm256_add_ps(yAvoid, _mm256_and_ps(avoid, _mm256_sub_ps(y, yFriend)));
+            vxSum = _mm256_add_ps(vxSum, _mm256_and_ps(flock, _mm256_maskload_ps(vxs + k, load)));
+            vySum = _mm256_add_ps(vySum, _mm256_and_ps(flock, _mm256_maskload_ps(vys + k, load)));
+            xSum = _mm256_add_ps(xSum, _mm256_and_ps(flock, xFriend));
+            ySum = _mm256_add_ps(ySum, _mm256_and_ps(flock, yFriend));
+            count = _mm256_add_ps(count, _mm256_and_ps(flock, one));
+        }
+        neighborhood.xAvoid += HorizontalSum(xAvoid);
+        neighborhood.yAvoid += HorizontalSum(yAvoid);
+        neighborhood.vxAvg += HorizontalSum(vxSum);
+        neighborhood.vyAvg += HorizontalSum(vySum);
+        neighborhood.xAvg += HorizontalSum(xSum);
+        neighborhood.yAvg += HorizontalSum(ySum);
+        neighborhood.neighbors += (unsigned int)HorizontalSum(count);
+    }
+
+    // GatherAvx2 with 16 lanes, AVX-512 masks replace the blend masks
+    template <bool FastMath>
+    HOST_TARGET("avx512f")
+    void GatherAvx512(const float* xs, const float* ys, const float* vxs, const float* vys, unsigned int begin, unsigned int end,
+        float px, float py, Neighborhood& neighborhood)
+    {
+        const __m512 one = _mm512_set1_ps(1.0f);
+        const __m512 visual = _mm512_set1_ps(RangeLimit<FastMath>(kVisualRange));
+        const __m512 protect = _mm512_set1_ps(RangeLimit<FastMath>(kProtectedRange));
+        __m512 x = _mm512_set1_ps(px);
+        __m512 y = _mm512_set1_ps(py);
+        __m512 xAvoid = _mm512_setzero_ps(), yAvoid = _mm512_setzero_ps();
+        __m512 vxSum = _mm512_setzero_ps(), vySum = _mm512_setzero_ps();
+        __m512 xSum = _mm512_setzero_ps(), ySum = _mm512_setzero_ps();
+        __m512 count = _mm512_setzero_ps();
+        for (unsigned int k = begin; k < end; k += 16)
+        {
+            __mmask16 load = end - k >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (end - k)) - 1);
+            __m512 xFriend = _mm512_maskz_loadu_ps(load, xs + k);
+            __m512 yFriend = _mm512_maskz_loadu_ps(load, ys + k);
+            __m512 dx = _mm512_sub_ps(xFriend, x);
+            __m512 dy = _mm512_sub_ps(yFriend, y);
+            __m512 measure = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+            if constexpr (!FastMath)
+                measure = _mm512_sqrt_ps(measure);
+            __mmask16 inRange = _mm512_mask_cmp_ps_mask(load, measure, visual, _CMP_LE_OQ);
+            if (!inRange)
+                continue;
+            __mmask16 avoid = _mm512_mask_cmp_ps_mask(inRange, measure, protect, _CMP_LT_OQ);
+            __mmask16 flock = inRange & ~avoid;
+            xAvoid = _mm512_mask_add_ps(xAvoid, avoid, xAvoid, _mm512_sub_ps(x, xFriend));
+            yAvoid = _mm512_mask_add_ps(yAvoid, avoid, yAvoid, _mm512_sub_ps(y, yFriend));
+            vxSum = _mm512_mask_add_ps(vxSum, flock, vxSum, _mm512_maskz_loadu_ps(flock, vxs + k));
+            vySum = _mm512_mask_add_ps(vySum, flock, vySum, _mm512_maskz_loadu_ps(flock, vys + k));
+            xSum = _mm512_mask_add_ps(xSum, flock, xSum, xFriend);
+            ySum = _mm512_mask_add_ps(ySum, flock, ySum, yFriend);
+            count = _mm512_mask_add_ps(count, flock, count, one);
+        }
+        neighborhood.xAvoid += _mm512_reduce_add_ps(xAvoid);
+        neighborhood.yAvoid += _mm512_reduce_add_ps(yAvoid);
+        neighborhood.vxAvg += _mm512_reduce_add_ps(vxSum);
+        neighborhood.vyAvg += _mm512_reduce_add_ps(vySum);
+        neighborhood.xAvg += _mm512_reduce_add_ps(xSum);
+        neighborhood.yAvg += _mm512_reduce_add_ps(ySum);
+        neighborhood.neighbors += (unsigned int)_mm512_reduce_add_ps(count);
+    }
+#endif
+}
+
+// Flocking step on the host for CPU-only machines, no SYCL queue involved. Every frame the boids are binned
+// into a row-major grid of host memory with copies of their state in cell order, so one stencil row is a
+// single contiguous run that the gather loop reads 8 (AVX2) or 16 (AVX-512) candidates at a time.
+// Slots write disjoint temporaries, so the threads of a pool kept for the engine's lifetime take batches
+// of them from a shared counter.
+class HostEngine
+{
+public:
+    explicit HostEngine(HostIsa requested)
+        : temporaryPositions(new Positions), temporaryVelocities(new Velocities)
+    {
+        // A requested instruction set is capped at what the machine supports
+        HostIsa supported = DetectHostIsa();
+        isa = requested == HostIsa::Auto || requested > supported ? supported : requested;
+        x.resize(kUnitCount);
+        y.resize(kUnitCount);
+        vx.resize(kUnitCount);
+        vy.resize(kUnitCount);
+        order.resize(kUnitCount);
+        cells.resize(kUnitCount);
+
+        // The calling thread is one of the workers
+        unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int t = 1; t < threadCount; t++)
+            workers.emplace_back([this]() { WorkerLoop(); });
+    }
+
+    ~HostEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            stopping = true;
+        }
+        jobPosted.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    HostEngine(const HostEngine&) = delete;
+    HostEngine& operator=(const HostEngine&) = delete;
+
+    // Runs one frame on boids, the host counterpart of RenderFrame
+    void Step(const Settings& settings, Boids& boids, const Point* mousePointer)
+    {
+        Bin(settings, boids);
+        FlockingRules rules = RulesOf(settings);
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            switch (isa)
+            {
+#ifdef HOST_SIMD
+            case HostIsa::Avx512:
+                Flock<Rules>(boids, rules.parameters, mousePointer, GatherAvx512<FastMath>);
+                break;
+            case HostIsa::Avx2:
+                Flock<Rules>(boids, rules.parameters, mousePointer, GatherAvx2<FastMath>);
+                break;
+#endif
+            default:
+                Flock<Rules>(boids, rules.parameters, mousePointer, GatherScalar<FastMath>);
+                break;
+            }
+            });
+
+        // Update position
+        boids.positions = *temporaryPositions;
+        boids.velocities = *temporaryVelocities;
+    }
+
+    HostIsa Isa() const { return isa; }
+
+private:
+    // Calls work(first, last) over batches of [0, kUnitCount) on every pool thread and the calling thread,
+    // returns once all batches are done
+    void ForEachBatch(const std::function<void(size_t, size_t)>& work)
+    {
+        std::atomic<size_t> nextBatch{ 0 };
+        std::function<void()> drain = [&]() {
+            for (size_t first = nextBatch.fetch_add(kHostSlotBatch); first < kUnitCount; first = nextBatch.fetch_add(kHostSlotBatch))
+                work(first, std::min(first + kHostSlotBatch, (size_t)kUnitCount));
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            job = &drain;
+            running = (unsigned int)workers.size();
+            generation++;
+        }
+        jobPosted.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(poolMutex);
+        jobDone.wait(lock, [&]() { return running == 0; });
+    }
+
+    // Pool threads sleep until a job is posted, run it once and report back
+    void WorkerLoop()
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            const std::function<void()>* work;
+            {
+                std::unique_lock<std::mutex> lock(poolMutex);
+                jobPosted.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                work = job;
+            }
+            (*work)();
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                running--;
+            }
+            jobDone.notify_one();
+        }
+    }
+
+    // Counting sort of the boids into row-major cells, the ghost ring stays empty
+    void Bin(const Settings& settings, const Boids& boids)
+    {
+        layout = MakeGridLayout(CellOrdering::RowMajor, settings.cellDivisions, false);
+        ForEachBatch([&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                cells[i] = CellIdAt(layout, boids.positions.x[i], boids.positions.y[i]);
+            });
+
+        cellStart.assign(layout.tableSize + 1, 0);
+        for (size_t i = 0; i < kUnitCount; i++)
+            cellStart[cells[i] + 1]++;
+        for (int c = 0; c < layout.tableSize; c++)
+            cellStart[c + 1] += cellStart[c];
+
+        std::vector<unsigned int> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < kUnitCount; i++)
+        {
+            unsigned int slot = next[cells[i]]++;
+            x[slot] = boids.positions.x[i];
+            y[slot] = boids.positions.y[i];
+            vx[slot] = boids.velocities.vx[i];
+            vy[slot] = boids.velocities.vy[i];
+            order[slot] = i;
+        }
+    }
+
+    template <typename Rules, typename GatherFunc>
+    void Flock(Boids& boids, const FlockingParameters& parameters, const Point* mousePointer, GatherFunc gather)
+    {
+        ForEachBatch([&](size_t first, size_t last) {
+            FlockSlots<Rules>(boids, parameters, mousePointer, gather, first, last);
+            });
+    }
+
+    template <typename Rules, typename GatherFunc>
+    void FlockSlots(Boids& boids, const FlockingParameters& parameters, const Point* mousePointer, GatherFunc gather, size_t first, size_t last)
+    {
+        int reach = layout.divisions;
+        for (size_t slot = first; slot < last; slot++)
+        {
+            int col, row;
+            CellCoordinates(layout, x[slot], y[slot], col, row);
+            Neighborhood neighborhood;
+
+            // Row-major cells of one stencil row are adjacent, their boids form one run
+            for (int r = row - reach; r <= row + reach; r++)
+            {
+                unsigned int begin = cellStart[CellId(layout, col - reach, r)];
+                unsigned int end = cellStart[CellId(layout, col + reach, r) + 1];
+                gather(x.data(), y.data(), vx.data(), vy.data(), begin, end, x[slot], y[slot], neighborhood);
+            }
+            UpdateBoid<Rules>(&boids, order[slot], neighborhood, parameters, mousePointer, temporaryPositions.get(), temporaryVelocities.get());
+        }
+    }
+
+    HostIsa isa;
+    GridLayout layout;
+    std::vector<unsigned int> cellStart;    // tableSize + 1 entries, cell c holds slots cellStart[c] to cellStart[c + 1]
+    std::vector<float> x, y, vx, vy;        // boid state in cell order
+    std::vector<int> order;                 // boid of every slot in cell order
+    std::vector<int> cells;                 // cell of every boid, by boid
+    std::unique_ptr<Positions> temporaryPositions;
+    std::unique_ptr<Velocities> temporaryVelocities;
+
+    std::vector<std::thread> workers;
+    std::mutex poolMutex;
+    std::condition_variable jobPosted;
+    std::condition_variable jobDone;
+    const std::function<void()>* job = nullptr;    // batches of the current frame step
+    unsigned long long generation = 0;              // jobs posted so far
+    unsigned int running = 0;                       // pool threads still on the current job
+    bool stopping = false;
+};
+
+namespace
+{
+    // Runs one frame from the same flock on the device and on the host engine and prints the largest
+    // difference, which only comes from the order of the neighbor sums. Restores the device flock.
+    // Returns whether the host engine is within kHostTolerance of the device.
+    // renderFrame(settings) renders one device frame, resetState() drops state carried between frames.
+    template <typename FrameFunc, typename ResetFunc>
+    bool ReportHostAccuracy(sycl::queue& q, const Settings& settings, HostEngine& engine, Boids* gpuBoids,
+        const Point* mousePointer, FrameFunc renderFrame, ResetFunc resetState)
+    {
+        Boids* snapshot = (Boids*)sycl::malloc_device(sizeof(Boids), q);
+        q.memcpy(snapshot, gpuBoids, sizeof(Boids)).wait();
+        std::unique_ptr<Boids> hostBoids(new Boids);
+        q.memcpy(hostBoids.get(), gpuBoids, sizeof(Boids)).wait();
+
+        resetState();
+        renderFrame(settings);
+        std::vector<float> reference = StateById(q, gpuBoids);
+        engine.Step(settings, *hostBoids, mousePointer);
+        std::vector<float> state = StateById(*hostBoids);
+
+        double maxPosition = 0.0, maxVelocity = 0.0;
+        for (size_t id = 0; id < kUnitCount; id++)
+        {
+            maxPosition = std::fmax(maxPosition, std::hypot(state[4 * id] - reference[4 * id], state[4 * id + 1] - reference[4 * id + 1]));
+            maxVelocity = std::fmax(maxVelocity, std::hypot(state[4 * id + 2] - reference[4 * id + 2], state[4 * id + 3] - reference[4 * id + 3]));
+        }
+        bool matches = maxPosition <= kHostTolerance && maxVelocity <= kHostTolerance;
+        printf("Host engine (%s) against the device after one frame: max position %.3g, max velocity %.3g%s\n", HostIsaName(engine.Isa()),
+            maxPosition, maxVelocity, matches ? "" : ", above tolerance, running on the device instead");
+
+        q.memcpy(gpuBoids, snapshot, sizeof(Boids)).wait();
+        resetState();
+        sycl::free(snapshot, q);
+        return matches;
+    }
+}
+#endif
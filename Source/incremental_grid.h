@@ -0,0 +1,121 @@
+#ifndef INCREMENTAL_GRID_H
+#define INCREMENTAL_GRID_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "cell_order.h"
+#include "radix_sort.h"
+
+// State kept between frames to repair the sorted particles grid instead of rebuilding it
+struct IncrementalGrid
+{
+    unsigned int* moved;            // 1 for grid slots whose boid changed cell
+    unsigned int* movedIndex;       // exclusive scan of moved
+    IdPair* migrants;
+    IdPair* migrantsHelper;
+    unsigned int* migrationCount;   // shared, number of boids that changed cell this frame
+    bool valid = false;             // particlesGrid holds last frame's sorted list
+};
+
+namespace
+{
+    IncrementalGrid AllocateIncrementalGrid(sycl::queue& q)
+    {
+        IncrementalGrid grid;
+        grid.moved = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        grid.movedIndex = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        grid.migrants = (IdPair*)sycl::malloc_device(kUnitCount * sizeof(IdPair), q);
+        grid.migrantsHelper = (IdPair*)sycl::malloc_device(kUnitCount * sizeof(IdPair), q);
+        grid.migrationCount = (unsigned int*)sycl::malloc_shared(sizeof(unsigned int), q);
+        return grid;
+    }
+
+    void FreeIncrementalGrid(sycl::queue& q, IncrementalGrid& grid)
+    {
+        sycl::free(grid.moved, q);
+        sycl::free(grid.movedIndex, q);
+        sycl::free(grid.migrants, q);
+        sycl::free(grid.migrantsHelper, q);
+        sycl::free(grid.migrationCount, q);
+    }
+
+    // Number of elements of sorted[0..n) with cellId < key, or <= key when inclusive
+    inline unsigned int CountBelow(const IdPair* sorted, unsigned int n, int key, bool inclusive)
+    {
+        unsigned int low = 0;
+        unsigned int high = n;
+        while (low < high)
+        {
+            unsigned int middle = (low + high) / 2;
+            int cellId = sorted[middle].cellId;
+            if (cellId < key || (inclusive && cellId == key))
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    // Boids move at most kMaxSpeed per frame across cells a fraction of kVisualRange wide, so only a few change
+    // cell between frames. Refreshes the cell ids of last frame's sorted particlesGrid, moves the
+    // boids that changed cell to a migration list, sorts that list and merges it back into the
+    // still sorted remainder. Returns false when the grid must be rebuilt from scratch: there is
+    // no previous frame, or more than migrationThreshold boids changed cell.
+    bool RepairSortedGrid(sycl::queue& q, Boids* boids, const GridLayout& layout, IdPair* particlesGrid, IdPair* particlesGridHelper,
+        IncrementalGrid& grid, unsigned int migrationThreshold, SortScratch& scratch)
+    {
+        if (!grid.valid)
+            return false;
+
+        sycl::range<1> numItems{ kUnitCount };
+        unsigned int* moved = grid.moved;
+        unsigned int* movedIndex = grid.movedIndex;
+        IdPair* migrants = grid.migrants;
+        unsigned int* migrationCount = grid.migrationCount;
+        GridLayout cells = layout;
+
+        *migrationCount = 0;
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            int id = particlesGrid[k].id;
+            int cellId = CellIdAt(cells, boids->positions.x[id], boids->positions.y[id]);
+            unsigned int changed = cellId != particlesGrid[k].cellId;
+            moved[k] = changed;
+            if (changed)
+            {
+                particlesGrid[k].cellId = cellId;
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                    sycl::access::address_space::global_space> count(*migrationCount);
+                count.fetch_add(1u);
+            }
+            }).wait();
+
+        unsigned int migrations = *migrationCount;
+        if (migrations > migrationThreshold)
+            return false;
+        if (migrations == 0)
+            return true;
+
+        // Split into sorted stayers (particlesGridHelper) and unsorted migrants
+        ExclusiveScan(q, moved, movedIndex, kUnitCount, scratch);
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            if (moved[k])
+                migrants[movedIndex[k]] = particlesGrid[k];
+            else
+                particlesGridHelper[k - movedIndex[k]] = particlesGrid[k];
+            }).wait();
+
+        RadixSort(q, migrants, grid.migrantsHelper, migrations, CountBits(layout.tableSize - 1),
+            [](const IdPair& pair) { return (unsigned int)pair.cellId; }, scratch);
+
+        // Merge, every element lands at its index plus its rank in the other list
+        unsigned int stayers = kUnitCount - migrations;
+        q.parallel_for(sycl::range<1>{ stayers }, [=](sycl::id<1> a) {
+            particlesGrid[a + CountBelow(migrants, migrations, particlesGridHelper[a].cellId, false)] = particlesGridHelper[a];
+            });
+        q.parallel_for(sycl::range<1>{ migrations }, [=](sycl::id<1> b) {
+            particlesGrid[b + CountBelow(particlesGridHelper, stayers, migrants[b].cellId, true)] = migrants[b];
+            });
+        q.wait();
+        return true;
+    }
+}
+#endif
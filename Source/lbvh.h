@@ -0,0 +1,220 @@
+#ifndef LBVH_H
+#define LBVH_H
+#include <CL/sycl.hpp>
+#include <cfloat>
+#include "boids.h"
+#include "cell_order.h"
+#include "cell_bounds.h"
+#include "radix_sort.h"
+#include "flocking.h"
+#include "nearest_neighbors.h"
+
+// Linear BVH over the boids. Internal nodes are 0..kUnitCount-2 with the root at 0,
+// leaf k is node kUnitCount-1+k and holds the k-th boid in Morton order.
+struct Lbvh
+{
+    unsigned int* codes;        // Morton code of every boid, sorted during the build
+    unsigned int* codesHelper;
+    int* ids;                   // boids in Morton order
+    int* idsHelper;
+    int* left;                  // children of the internal nodes
+    int* right;
+    int* parent;                // of every node, -1 for the root
+    CellBox* boxes;             // of every node
+    unsigned int* visits;       // children that reached each internal node during the bottom-up pass
+};
+
+namespace
+{
+    constexpr int kLbvhInternalNodes = kUnitCount - 1;
+    constexpr int kLbvhNodes = 2 * kUnitCount - 1;
+    constexpr int kLbvhAxisBits = 10;       // about 1.6 pixels across the window, ties are split by index
+    constexpr int kLbvhStackSize = 64;      // depth is at most 2 * kLbvhAxisBits code bits plus 14 index bits
+    constexpr float kLbvhCodeScale = (1 << kLbvhAxisBits) - 1;
+
+    Lbvh AllocateLbvh(sycl::queue& q)
+    {
+        Lbvh bvh;
+        bvh.codes = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        bvh.codesHelper = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        bvh.ids = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        bvh.idsHelper = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        bvh.left = (int*)sycl::malloc_device(kLbvhInternalNodes * sizeof(int), q);
+        bvh.right = (int*)sycl::malloc_device(kLbvhInternalNodes * sizeof(int), q);
+        bvh.parent = (int*)sycl::malloc_device(kLbvhNodes * sizeof(int), q);
+        bvh.boxes = (CellBox*)sycl::malloc_device(kLbvhNodes * sizeof(CellBox), q);
+        bvh.visits = (unsigned int*)sycl::malloc_device(kLbvhInternalNodes * sizeof(unsigned int), q);
+        return bvh;
+    }
+
+    void FreeLbvh(sycl::queue& q, Lbvh& bvh)
+    {
+        sycl::free(bvh.codes, q);
+        sycl::free(bvh.codesHelper, q);
+        sycl::free(bvh.ids, q);
+        sycl::free(bvh.idsHelper, q);
+        sycl::free(bvh.left, q);
+        sycl::free(bvh.right, q);
+        sycl::free(bvh.parent, q);
+        sycl::free(bvh.boxes, q);
+        sycl::free(bvh.visits, q);
+    }
+
+    // Length of the common prefix of sorted keys a and b, equal codes are told apart by their index.
+    // -1 when b is out of range.
+    inline int CommonPrefix(const unsigned int* codes, int a, int b)
+    {
+        if (b < 0 || b >= (int)kUnitCount)
+            return -1;
+        if (codes[a] == codes[b])
+            return 32 + sycl::clz((unsigned int)(a ^ b));
+        return sycl::clz(codes[a] ^ codes[b]);
+    }
+
+    // Builds the tree from the current positions (Karras 2012): Morton codes over the window, a radix sort,
+    // every internal node finds its key range and split independently, then boxes are merged bottom-up
+    // by the second child to arrive. Boids outside the window get clamped codes, the boxes stay exact.
+    void BuildLbvh(sycl::queue& q, const Boids* boids, Lbvh& bvh, SortScratch& scratch)
+    {
+        sycl::range<1> numItems{ kUnitCount };
+        unsigned int* codes = bvh.codes;
+        int* ids = bvh.ids;
+        int* left = bvh.left;
+        int* right = bvh.right;
+        int* parent = bvh.parent;
+        CellBox* boxes = bvh.boxes;
+        unsigned int* visits = bvh.visits;
+
+        q.parallel_for(numItems, [=](sycl::id<1> i) {
+            float x = sycl::min(sycl::max(boids->positions.x[i] / kWindowWidth, 0.0f), 1.0f);
+            float y = sycl::min(sycl::max(boids->positions.y[i] / kWindowHeight, 0.0f), 1.0f);
+            codes[i] = MortonCode((unsigned int)(x * kLbvhCodeScale), (unsigned int)(y * kLbvhCodeScale));
+            ids[i] = i;
+            }).wait();
+        RadixSortByKey(q, codes, ids, bvh.codesHelper, bvh.idsHelper, kUnitCount, 2 * kLbvhAxisBits, scratch);
+
+        // Internal nodes
+        q.memset(visits, 0, kLbvhInternalNodes * sizeof(unsigned int)).wait();
+        q.parallel_for(sycl::range<1>{ (size_t)kLbvhInternalNodes }, [=](sycl::id<1> id) {
+            int i = id;
+            int direction = CommonPrefix(codes, i, i + 1) > CommonPrefix(codes, i, i - 1) ? 1 : -1;
+
+            // The range extends from i in direction while keys share more than deltaMin bits
+            int deltaMin = CommonPrefix(codes, i, i - direction);
+            int lengthMax = 2;
+            while (CommonPrefix(codes, i, i + lengthMax * direction) > deltaMin)
+                lengthMax *= 2;
+            int length = 0;
+            for (int t = lengthMax / 2; t >= 1; t /= 2)
+                if (CommonPrefix(codes, i, i + (length + t) * direction) > deltaMin)
+                    length += t;
+            int j = i + length * direction;
+
+            // Split where the common prefix of the range ends
+            int deltaNode = CommonPrefix(codes, i, j);
+            int split = 0;
+            for (int t = (length + 1) / 2; ; t = (t + 1) / 2)
+            {
+                if (CommonPrefix(codes, i, i + (split + t) * direction) > deltaNode)
+                    split += t;
+                if (t == 1)
+                    break;
+            }
+            int gamma = i + split * direction + (direction < 0 ? -1 : 0);
+
+            int first = i < j ? i : j;
+            int last = i < j ? j : i;
+            left[i] = first == gamma ? kLbvhInternalNodes + gamma : gamma;
+            right[i] = last == gamma + 1 ? kLbvhInternalNodes + gamma + 1 : gamma + 1;
+            parent[left[i]] = i;
+            parent[right[i]] = i;
+            if (i == 0)
+                parent[0] = -1;
+            }).wait();
+
+        // Leaf boxes, then unions up to the root
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            int leaf = kLbvhInternalNodes + (int)k;
+            float x = boids->positions.x[ids[k]];
+            float y = boids->positions.y[ids[k]];
+            boxes[leaf] = { x, y, x, y };
+            for (int node = parent[leaf]; node != -1; node = parent[node])
+            {
+                sycl::atomic_ref<unsigned int, sycl::memory_order::acq_rel, sycl::memory_scope::device,
+                    sycl::access::address_space::global_space> visit(visits[node]);
+                if (visit.fetch_add(1u) == 0)
+                    return;
+                CellBox a = boxes[left[node]];
+                CellBox b = boxes[right[node]];
+                boxes[node] = { sycl::min(a.minX, b.minX), sycl::min(a.minY, b.minY), sycl::max(a.maxX, b.maxX), sycl::max(a.maxY, b.maxY) };
+            }
+            }).wait();
+    }
+
+    // Calls visit(j) for every boid j whose position is within range of (x, y)
+    template <typename VisitFunc>
+    inline void QueryLbvh(const Lbvh& bvh, float x, float y, float range, VisitFunc&& visit)
+    {
+        int stack[kLbvhStackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            int node = stack[--top];
+            if (BoxDistanceSquared(bvh.boxes[node], x, y) > range * range)
+                continue;
+            if (node >= kLbvhInternalNodes)
+            {
+                visit(bvh.ids[node - kLbvhInternalNodes]);
+                continue;
+            }
+            stack[top++] = bvh.right[node];
+            stack[top++] = bvh.left[node];
+        }
+    }
+
+    // Pushes the nearestCount nearest boids to (x, y), other than boid i, into heap.
+    // Subtrees farther than the farthest entry of a full heap are skipped.
+    inline void NearestInLbvh(const Lbvh& bvh, const Boids* boids, int i, float x, float y, int nearestCount, NeighborHeap& heap)
+    {
+        int stack[kLbvhStackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            int node = stack[--top];
+            if (heap.size == nearestCount && BoxDistanceSquared(bvh.boxes[node], x, y) >= heap.distances[0])
+                continue;
+            if (node >= kLbvhInternalNodes)
+            {
+                int j = bvh.ids[node - kLbvhInternalNodes];
+                float dx = boids->positions.x[j] - x;
+                float dy = boids->positions.y[j] - y;
+                if (j != i)
+                    PushNeighbor(heap, nearestCount, dx * dx + dy * dy, j);
+                continue;
+            }
+            stack[top++] = bvh.right[node];
+            stack[top++] = bvh.left[node];
+        }
+    }
+
+    // Runs the flocking rules with neighbors found in the tree
+    void LbvhFlockingStep(FlockingKernels& kernels, Boids* boids, const Lbvh& bvh, int nearestCount, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        Lbvh tree = bvh;
+        if (nearestCount > 0)
+        {
+            NearestFlockingStep<NearestLbvhSite>(kernels, boids, nearestCount, mousePointer, temporaryPositions, temporaryVelocities, rules,
+                [=](int i, float x, float y, NeighborHeap& heap) {
+                    NearestInLbvh(tree, boids, i, x, y, nearestCount, heap);
+                });
+            return;
+        }
+        FlockingStep<LbvhSite>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, rules, [=](int i, auto&& visit) {
+            QueryLbvh(tree, boids->positions.x[i], boids->positions.y[i], kVisualRange, visit);
+            });
+    }
+}
+#endif
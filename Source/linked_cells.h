@@ -0,0 +1,20 @@
+#ifndef LINKED_CELLS_H
+#define LINKED_CELLS_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+
+namespace
+{
+    // Pushes every boid onto the list of its cell with a single atomic exchange, no sorting.
+    // cellHead[c] is the first boid of cell c, cellNext[i] the boid after i, -1 ends a list.
+    void BuildLinkedCells(sycl::queue& q, const IdPair* particlesGrid, int* cellHead, int* cellNext, int tableSize)
+    {
+        q.fill(cellHead, -1, tableSize).wait();
+        q.parallel_for(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> i) {
+            sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                sycl::access::address_space::global_space> head(cellHead[particlesGrid[i].cellId]);
+            cellNext[i] = head.exchange((int)i);
+            }).wait();
+    }
+}
+#endif
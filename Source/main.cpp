@@ -2,6 +2,7 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <memory>
 #include <iostream>
 #include <stdlib.h> 
 #include <cmath>
@@ -13,7 +14,26 @@
 #include <windows.h>
 
 #include "constants.h"
+#include "boids.h"
 #include "shaders.h"
+#include "radix_sort.h"
+#include "flocking.h"
+#include "reorder.h"
+#include "neighbor_list.h"
+#include "nearest_neighbors.h"
+#include "spatial_grid.h"
+#include "symmetric_flocking.h"
+#include "tiled_flocking.h"
+#include "subgroup_flocking.h"
+#include "lbvh.h"
+#include "sweep_and_prune.h"
+#include "fused_frame.h"
+#include "settings.h"
+#include "cell_order.h"
+#include "benchmark.h"
+#include "cell_size_tuner.h"
+#include "math_accuracy.h"
+#include "host_flocking.h"
 
 #define __cdecl
 #define __stdcall
@@ -21,42 +41,6 @@
 using namespace sycl;
 
 
-struct Positions
-{
-    float x[kUnitCount];
-    float y[kUnitCount];
-};
-
-struct Velocities
-{
-    float vx[kUnitCount];
-    float vy[kUnitCount];
-};
-
-struct Point
-{
-    float x;
-    float y;
-};
-
-struct TrianglePositions
-{
-    Point p1, p2, p3;
-};
-
-struct Boids
-{
-    Positions positions;
-    Velocities velocities;
-    TrianglePositions trianglePositions[kUnitCount];
-};
-
-struct IdPair
-{
-    int id;
-    int cellId;
-};
-
 bool pauseFlag = false;
 
 
@@ -80,326 +64,136 @@ void PauseCallback(GLFWwindow* window, int key, int scancode, int action, int mo
         pauseFlag = !pauseFlag;
 }
 
-void Swap(IdPair* a, IdPair* b)
-{
-    IdPair t = *a;
-    *a = *b;
-    *b = t;
-}
-
-int Partition(IdPair* particlesGrid, int low, int high)
-{
-    int pivot = particlesGrid[high].cellId;
-    int i = (low - 1);
-    for (int j = low; j <= high - 1; j++) {
-        if (particlesGrid[j].cellId < pivot) {
-            i++;
-            Swap(&particlesGrid[i], &particlesGrid[j]);
-        }
-    }
-    Swap(&particlesGrid[i + 1], &particlesGrid[high]);
-    return (i + 1);
-}
-
-void QuickSort(IdPair* particlesGrid, int low, int high)
-{
-    if (low < high) {
-        int pi = Partition(particlesGrid, low, high);
-        QuickSort(particlesGrid, low, pi - 1);
-        QuickSort(particlesGrid, pi + 1, high);
-    }
-}
-
-int* CalculateCellIdList(Boids* boids, int i, int &n)
+// Runs the flocking step over the grid. With a neighbor skin the step iterates the Verlet lists instead
+// and uses the grid only to rebuild them and for boids whose list overflowed. The topological mode searches
+// the grid for the nearest boids. The symmetric engine walks cell pairs of a bounded grid and accumulates
+// into pairSums, the tiled engine stages neighbor cells in local memory per work-group and the sub-group
+// engine splits the candidates of every boid across the lanes of a sub-group.
+void FlockOverGrid(queue& q, FlockingKernels& kernels, const Settings& settings, Boids* boids, const GridView& grid, NeighborList& neighborList, bool rebuildList,
+    Neighborhood* pairSums, Positions* temporaryPositions, Velocities* temporaryVelocities, Point* mousePointer)
 {
-    int neighborID[9];
-    float x = boids->positions.x[i];
-    float y = boids->positions.y[i];
-    int row = y / kVisualRange;
-    int col = x / kVisualRange;
-    int cellID = col + row * kGridColsNum;
-
-    neighborID[0] = cellID;
-    n = 1;
+    FlockingRules rules = RulesOf(settings);
+    GridView view = grid;
+    auto gridNeighbors = [=](int i, auto&& visit) {
+        view.ForEachNeighbor(boids, i, kVisualRange, visit);
+    };
 
-    if(row-1>0 && col-1>0)    // left-top
+    if (settings.nearestNeighbors > 0)
     {
-        neighborID[n] = cellID - kGridColsNum - 1;
-        n++;
+        NearestNeighborStep(kernels, boids, grid, settings.nearestNeighbors, mousePointer, temporaryPositions, temporaryVelocities, rules);
+        return;
     }
-    if (row - 1 > 0)    // top
-    {
-        neighborID[n] = cellID - kGridColsNum;
-        n++;
-    }
-    if (row - 1 > 0 && col + 1 < kGridColsNum)    // right-top
-    {
-        neighborID[n] = cellID - kGridColsNum + 1;
-        n++;
-    }
-    if (col - 1 > 0)    // left
-    {
-        neighborID[n] = cellID - 1;
-        n++;
-    }
-    if (col + 1 < kGridColsNum)    // right
+
+    if (settings.flockingMethod == FlockingMethod::Symmetric && settings.neighborSkin <= 0.0f && !grid.layout.hashed)
     {
-        neighborID[n] = cellID +1;
-        n++;
+        SymmetricFlockingStep(q, kernels, boids, grid, pairSums, mousePointer, temporaryPositions, temporaryVelocities, rules);
+        return;
     }
-    if (row + 1 < kGridRowsNum && col -1 > 0)    // left-bottom
+
+    if (settings.flockingMethod == FlockingMethod::Tiled && settings.neighborSkin <= 0.0f && TiledFlockingApplies(grid))
     {
-        neighborID[n] = cellID + kGridColsNum - 1;
-        n++;
+        TiledFlockingStep(kernels, boids, grid, mousePointer, temporaryPositions, temporaryVelocities, rules);
+        return;
     }
-    if (row + 1 < kGridRowsNum)    // bottom
+
+    if (settings.flockingMethod == FlockingMethod::SubGroup && settings.neighborSkin <= 0.0f && SubGroupFlockingApplies(grid))
     {
-        neighborID[n] = cellID + kGridColsNum;
-        n++;
+        SubGroupFlockingStep(kernels, boids, grid, mousePointer, temporaryPositions, temporaryVelocities, rules);
+        return;
     }
-    if (row + 1 < kGridRowsNum && col + 1 < kGridColsNum)    // right-bottom
+
+    if (settings.neighborSkin <= 0.0f)
     {
-        neighborID[n] = cellID + kGridColsNum + 1;
-        n++;
+        FlockingStep<GatherSite>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, rules, gridNeighbors);
+        return;
     }
 
-    return neighborID;
+    if (rebuildList)
+        BuildNeighborList(q, boids, grid, neighborList, settings.neighborSkin);
+
+    int* neighbors = neighborList.neighbors;
+    int* counts = neighborList.counts;
+    int capacity = neighborList.capacity;
+    FlockingStep<ListSite>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, rules, [=](int i, auto&& visit) {
+        if (counts[i] > capacity)
+        {
+            gridNeighbors(i, visit);
+            return;
+        }
+        for (int k = 0; k < counts[i]; k++)
+            visit(neighbors[i * capacity + k]);
+        });
+    neighborList.age++;
 }
 
-void RenderFrame(queue& q, Boids* boids, IdPair* particlesGrid, int* cellStart, Positions* temporaryPositions, Velocities* temporaryVelocities, Point* mousePointer)
+void RenderFrame(queue& q, FlockingKernels& kernels, const Settings& settings, int frameNumber, Boids* boids, SpatialGrid& grid, SortScratch& sortScratch,
+    NeighborList& neighborList, Neighborhood* pairSums, Lbvh& lbvh, SweepAndPrune& sweepAndPrune, FusedGrid& fusedGrid, Positions* temporaryPositions, Velocities* temporaryVelocities, int* temporaryIds, Point* mousePointer)
 {
-    // Fill unordered list (id, cellid)
     range<1> numItems{ kUnitCount };
+    FlockingRules rules = RulesOf(settings);
 
-    q.submit([&](handler& h) {
-        h.parallel_for(numItems, [=](id<1> i) {
-    float x = boids->positions.x[i];
-    float y = boids->positions.y[i];
-    int row = y / kVisualRange;
-    int col = x / kVisualRange;
-    int cellId = col + row * kGridColsNum;
-    particlesGrid[i].cellId = cellId;
-    particlesGrid[i].id = i;
-    cellStart[i] = -1;
-    });
-    });
-    q.wait();
-
-    // Sort the list with quicksort
-    QuickSort(particlesGrid, 0, kUnitCount - 1);
-
-    //RADIX SORT
-    //for (int i = 0; i < 1024; i++)
-    //    tab[i] = 0;
-    //for (int i = 0; i < kUnitCount; i++)
-    //    tab[particlesGrid[i].id]++;
-
-    //indexes->bits = 0;
-    //indexes->j = 1;
-
-    //int num_bits = CountBits(kCellsNumTotal);
-    //for (; indexes->bits < num_bits - 1; indexes->j *= 2, indexes->bits++)
-    //{
-    //    int j = indexes->j;
-    //    q.parallel_for(numItems, [=](id<1> i) {
-    //        int result = ((particlesGrid[i].cellId & indexes->j) == 0 ? 0 : 1);
-    //    sortArrays->flags[i] = result;
-    //    sortArrays->I_down[i] = !result;
-    //    sortArrays->I_up[kUnitCount - i - 1] = result;
-    //        }).wait();
-
-    //        // I_down
-
-    //        q.single_task([=]() {sortArrays->I_down[kUnitCount - 1] = 0; });
-    //        for (indexes->d = log2(kUnitCount) - 1; indexes->d >= 0; indexes->d--)
-    //        {
-    //            int size = (kUnitCount - 1 / pow(2, indexes->d + 1));
-    //            range<1> items{ size };
-    //            q.parallel_for(items, [=](id<1> k) {
-    //                int d = indexes->d;
-    //            int t = sortArrays->I_down[k + (int)std::pow(2, d) - 1];
-    //            sortArrays->I_down[k + (int)std::pow(2, d) - 1] = sortArrays->I_down[k + (int)std::pow(2, d + 1) - 1];
-    //            sortArrays->I_down[k + (int)std::pow(2, d + 1) - 1] = t + sortArrays->I_down[k + (int)std::pow(2, d + 1) - 1];
-    //                }).wait();
-    //        }
-
-    //        // I_up
-    //        for (indexes->d = 0; indexes->d <= log2(kUnitCount) - 1; indexes->d++)
-    //        {
-    //            int size = (kUnitCount - 1) / (pow(2, indexes->d + 1));
-    //            range<1> items{ size };
-    //            q.parallel_for(items, [=](id<1> k) {
-    //                int d = indexes->d;
-    //            sortArrays->I_up[k + (int)std::pow(2, d + 1) - 1] = sortArrays->I_up[k + (int)std::pow(2, d) - 1] + sortArrays->I_up[k + (int)std::pow(2, d + 1) - 1];
-    //                }).wait();
-    //        }
-
-
-    //        q.parallel_for(numItems, [=](id<1> i) {
-    //            sortArrays->I_up[i] = kUnitCount - sortArrays->I_up[i];
-    //        particlesGridHelper[i].cellId = particlesGrid[i].cellId;
-    //        particlesGridHelper[i].id = particlesGrid[i].id;
-    //        if (sortArrays->flags[i])
-    //            sortArrays->index[i] = sortArrays->I_up[i];
-    //        else
-    //            sortArrays->index[i] = sortArrays->I_down[i];
-    //            }).wait();
-
-    //            q.parallel_for(numItems, [=](id<1> i) {
-    //                int index = sortArrays->index[i];
-    //            particlesGrid[index].cellId = particlesGridHelper[i].cellId;
-    //            particlesGrid[index].id = particlesGridHelper[i].id;
-    //                }).wait();
-    //}
-
-    range<1> numItemsReduced{ kUnitCount - 1 };
-
-    // Fill cellStart array
-    q.single_task([=]() {cellStart[particlesGrid[0].cellId] = 0; });
-    q.parallel_for(numItemsReduced, [=](id<1> i) {
-        if (particlesGrid[i + 1].cellId != particlesGrid[i].cellId)
-            cellStart[particlesGrid[i].cellId] = i;
-        }).wait();
-
-    q.parallel_for(numItems, [=](id<1> i) {
-    float x = boids->positions.x[i];
-    float y = boids->positions.y[i];
-    float vx = boids->velocities.vx[i];
-    float vy = boids->velocities.vy[i];
-    auto distance = [&](float x1, float y1, float x2, float y2)
+    // The fused frame bins its own grid while flocking, any other frame leaves it stale
+    if (settings.fusedFrame && FusedFrameApplies(settings))
     {
-        return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
-    };
-    // New velocity
-    float xAvoid = 0.0f;
-    float yAvoid = 0.0f;
-
-    float vxAvg = 0.0f;
-    float vyAvg = 0.0f;
-
-    float xAvg = 0.0f;
-    float yAvg = 0.0f;
-
-    unsigned int neighbors = 0;
-
-    // Process every neighbor cell
-    int n;
-    int* neighborCells = CalculateCellIdList(boids, i, n);
-
-    for (int counter = 0; counter < n; counter++)
-    {
-        int cellNum = neighborCells[counter];
-        int particleNum = cellStart[cellNum];
-        while (particlesGrid[particleNum].cellId == cellNum)
-        {
-            int j = particlesGrid[particleNum].id;
-            particleNum++;
-            if (j == i) continue;
-            float xFriend = boids->positions.x[j];
-            float yFriend = boids->positions.y[j];
-            float dist = distance(x, y, xFriend, yFriend);
-            if (dist > kVisualRange)
-                continue;
-
-            float xFriendVelocity = boids->velocities.vx[j];
-            float yFriendVelocity = boids->velocities.vy[j];
-
-            if (dist < kProtectedRange)
-            {
-                xAvoid += x - xFriend;
-                yAvoid += y - yFriend;
-                continue;
-            }
-            neighbors++;
-            vxAvg += xFriendVelocity;
-            vyAvg += yFriendVelocity;
-            xAvg += xFriend;
-            yAvg += yFriend;
-
-        }
+        FusedFrame(q, kernels, settings, boids, fusedGrid, mousePointer, temporaryPositions, temporaryVelocities);
+        grid.Invalidate();
+        return;
     }
-    // Mouse pointer avoiding
-    int xMouse = mousePointer->x;
-    int yMouse = mousePointer->y;
-    int xMouseAvoid = 0;
-    int yMouseAvoid = 0;
-    float pointerDistance = distance(x, y, xMouse, yMouse);
-
-    if (pointerDistance < kVisualRange)
+    fusedGrid.valid = false;
+
+    // Sweep and prune runs along the axis of largest variance, the automatic mode takes it over the sort grid
+    // only while the flock is stretched along that axis
+    bool sweep = false;
+    bool sweepAlongY = false;
+    Settings gridSettings = settings;
+    if (settings.gridMethod == GridMethod::Sweep || settings.gridMethod == GridMethod::Auto)
     {
-        xMouseAvoid = x - xMouse;
-        yMouseAvoid = y - yMouse;
+        float varianceX, varianceY;
+        EstimateVariances(q, boids, sweepAndPrune, varianceX, varianceY);
+        sweep = settings.gridMethod == GridMethod::Sweep || SweepPaysOff(varianceX, varianceY);
+        sweepAlongY = varianceY > varianceX;
+        gridSettings.gridMethod = GridMethod::Sort;
     }
-    vx += xMouseAvoid * kMouseFactor;
-    vy += yMouseAvoid * kMouseFactor;
 
-    if (neighbors > 0)
-    {
-        // Alignment
-        vxAvg /= neighbors;
-        vyAvg /= neighbors;
-        vx += (vxAvg - vx) * kAlignFactor;
-        vy += (vyAvg - vy) * kAlignFactor;
-
-        // Cohesion
-        xAvg /= neighbors;
-        yAvg /= neighbors;
-        vx += (xAvg - x) * kCenteringFactor;
-        vy += (yAvg - y) * kCenteringFactor;
-    }
+    // With neighbor lists the grid is only needed to rebuild them and for overflowed lists, the BVH replaces it
+    bool useList = settings.neighborSkin > 0.0f && settings.nearestNeighbors == 0;
+    bool rebuildList = useList && NeighborListExpired(neighborList, settings.neighborSkin, MaxFrameSpeed(rules));
+    bool buildGrid = settings.gridMethod != GridMethod::Bvh && !sweep && (!useList || rebuildList || *neighborList.overflowCount > 0);
 
-    // Separation
-    vx += xAvoid * kAvoidFactor;
-    vy += yAvoid * kAvoidFactor;
+    if (buildGrid)
+    {
+        grid.Build(gridSettings, boids, sortScratch);
 
+        // Move boids into cell order so neighbors in one cell are contiguous in memory, lists refer to old slots
+        if (settings.reorderInterval > 0 && frameNumber % settings.reorderInterval == 0 && grid.GroupedList() != nullptr)
+        {
+            ReorderBoids(q, boids, grid.GroupedList(), temporaryPositions, temporaryVelocities, temporaryIds);
+            rebuildList = useList;
+        }
+    }
 
-    // Margin
-    if (x < kLeftMarginSize)
-        vx += kTurnFactor;
-    else if (x > kRightMarginSize)
-        vx -= kTurnFactor;
-    if (y < kBottomMarginSize)
-        vy += kTurnFactor;
-    else if (y > kTopMarginSize)
-        vy -= kTurnFactor;
+    // The mouse rule only acts on boids in range of the pointer, while none is the kernels without it run.
+    // The rule truncates the pointer to whole pixels, so the query reaches two pixels further.
+    if (buildGrid && settings.mouseAvoidance && !grid.AnyWithin(boids, mousePointer, kVisualRange + 2.0f))
+        gridSettings.mouseAvoidance = false;
 
-    // Speed limit
-    float speed = sqrt(vx * vx + vy * vy);
-    if (speed > kMaxSpeed)
+    // Process every neighbor cell
+    if (sweep)
     {
-        vx = vx / speed * kMaxSpeed;
-        vy = vy / speed * kMaxSpeed;
+        // Rebuilt every frame, lists and grid state from earlier frames no longer match once boids moved
+        BuildSweepAndPrune(q, boids, sweepAndPrune, sweepAlongY, sortScratch);
+        SweepFlockingStep(kernels, boids, sweepAndPrune, settings.nearestNeighbors, mousePointer, temporaryPositions, temporaryVelocities, rules);
+        neighborList.valid = false;
+        grid.Invalidate();
     }
-
-    if (speed < kMinSpeed)
+    else if (settings.gridMethod == GridMethod::Bvh)
     {
-        vx = vx / speed * kMinSpeed;
-        vy = vy / speed * kMinSpeed;
+        // Rebuilt every frame, Verlet lists and cell culling do not apply
+        BuildLbvh(q, boids, lbvh, sortScratch);
+        LbvhFlockingStep(kernels, boids, lbvh, settings.nearestNeighbors, mousePointer, temporaryPositions, temporaryVelocities, rules);
     }
-
-    float xVelocity = -boids->velocities.vy[i];
-    float yVelocity = boids->velocities.vx[i];
-    float scale = 2 / sqrt(xVelocity * xVelocity + yVelocity * yVelocity);
-    xVelocity *= scale;
-    yVelocity *= scale;
-
-    float xNew = x + vx;
-    float yNew = y + vy;
-
-    // Write velocity and position to temporary buffer
-    temporaryVelocities->vx[i] = vx;
-    temporaryVelocities->vy[i] = vy;
-    temporaryPositions->x[i] = xNew;
-    temporaryPositions->y[i] = yNew;
-
-    // Triangle positions can be updated safely
-    boids->trianglePositions[i].p1.x = xNew + xVelocity;
-    boids->trianglePositions[i].p1.y = yNew + yVelocity;
-    boids->trianglePositions[i].p2.x = xNew - xVelocity;
-    boids->trianglePositions[i].p2.y = yNew - yVelocity;
-    boids->trianglePositions[i].p3.x = xNew + vx * scale * 2.5;
-    boids->trianglePositions[i].p3.y = yNew + vy * scale * 2.5;
-        }).wait();
+    else
+        FlockOverGrid(q, kernels, gridSettings, boids, grid.View(), neighborList, rebuildList, pairSums, temporaryPositions, temporaryVelocities, mousePointer);
 
     // Update position
     q.parallel_for(numItems, [=](id<1> i) {
@@ -420,6 +214,7 @@ void InitializeInput(Boids &boids)
         float randAngle = (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)) * 3.141592653589 * 2;
         boids.velocities.vx[i] = kMinSpeed * cos(randAngle);
         boids.velocities.vy[i] = kMinSpeed * sin(randAngle);
+        boids.ids[i] = i;
         float xVelocity = -boids.velocities.vy[i];
         float yVelocity = boids.velocities.vx[i];
         float scale = 2 / sqrt(xVelocity * xVelocity + yVelocity * yVelocity);
@@ -436,9 +231,12 @@ void InitializeInput(Boids &boids)
 }
 
 
-int main(int argc, char* argv[]) {
+// Opens the window and renders frames until it is closed, renderFrame() schedules one frame. Triangles are
+// copied from gpuBoids after every frame, frames rendered on the host pass nullptr and write cpuBoids.
+template <typename FrameFunc>
+int RunWindow(queue& q, Boids& cpuBoids, Boids* gpuBoids, Point* mousePointer, FrameFunc renderFrame)
+{
     GLFWwindow* window;
-
     if (!glfwInit())
         return -1;
 
@@ -462,9 +260,6 @@ int main(int argc, char* argv[]) {
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
 
-    default_selector defaultSelector;
-    queue q(defaultSelector, ExceptionHandler);
-
     unsigned int shader = CreateShader(vertexShader, fragmentShader);
     glUseProgram(shader);
 
@@ -472,21 +267,6 @@ int main(int argc, char* argv[]) {
     int location = glGetUniformLocation(shader, "u_MVP");
     glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(proj));
 
-    Boids cpuBoids;
-    InitializeInput(cpuBoids);
-
-    // Allocate and fill buffers in GPU memory
-    IdPair* particlesGrid = (IdPair*)malloc_shared(kUnitCount * sizeof(IdPair), q);
-    Boids* gpuBoids = (Boids*)malloc_device(sizeof(Boids), q);
-    Positions* temporaryPositions = (Positions*)malloc_device(sizeof(Positions), q);
-    Velocities* temporaryVelocities = (Velocities*)malloc_device(sizeof(Velocities), q);
-    Point *mousePointer = (Point*)malloc_shared(sizeof(Point), q);
-
-    int* cellStart = (int*)malloc_device(kUnitCount* sizeof(int), q);
-
-    q.submit([&](handler& h) {
-        h.memcpy(gpuBoids, &cpuBoids, sizeof(Boids));}).wait();
-
     double lastTime = glfwGetTime();
     int nbFrames = 0;
 
@@ -512,7 +292,7 @@ int main(int argc, char* argv[]) {
 
         glClear(GL_COLOR_BUFFER_BIT);
         // schedule frame to render
-        RenderFrame(q, gpuBoids, particlesGrid, cellStart, temporaryPositions, temporaryVelocities, mousePointer);
+        renderFrame();
         //draw
         glBufferData(GL_ARRAY_BUFFER, kUnitCount * sizeof(float)*6, &(cpuBoids.trianglePositions), GL_STREAM_DRAW);
         glDrawArrays(GL_TRIANGLES, 0, kUnitCount * 3);
@@ -520,16 +300,103 @@ int main(int argc, char* argv[]) {
         glfwPollEvents();
 
         //wait until frame is rendered and copy rendered frame to host
-        q.submit([&](handler& h) {
-            h.memcpy(&(cpuBoids.trianglePositions), &(gpuBoids->trianglePositions),kUnitCount * sizeof(float)*6);}).wait();
+        if (gpuBoids != nullptr)
+            q.submit([&](handler& h) {
+                h.memcpy(&(cpuBoids.trianglePositions), &(gpuBoids->trianglePositions),kUnitCount * sizeof(float)*6);}).wait();
     }
     glfwTerminate();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings = ParseSettings(argc, argv);
+    if (settings.benchmark == BenchmarkMode::Ordering)
+    {
+        RunCellOrderingBenchmark();
+        return 0;
+    }
+
+    default_selector defaultSelector;
+    queue q(defaultSelector, ExceptionHandler);
+
+    Boids cpuBoids;
+    InitializeInput(cpuBoids);
+
+    // Allocate and fill buffers in GPU memory
+    SpatialGrid grid(q);
+    FlockingKernels flockingKernels(q);
+    SortScratch sortScratch = AllocateSortScratch(q, kUnitCount > kCellTableCapacity ? kUnitCount : kCellTableCapacity);
+    Boids* gpuBoids = (Boids*)malloc_device(sizeof(Boids), q);
+    Positions* temporaryPositions = (Positions*)malloc_device(sizeof(Positions), q);
+    Velocities* temporaryVelocities = (Velocities*)malloc_device(sizeof(Velocities), q);
+    int* temporaryIds = (int*)malloc_device(kUnitCount * sizeof(int), q);
+    Point *mousePointer = (Point*)malloc_shared(sizeof(Point), q);
+
+    NeighborList neighborList = AllocateNeighborList(q, settings.neighborSkin > 0.0f ? settings.neighborCapacity : 0);
+    Neighborhood* pairSums = (Neighborhood*)malloc_device(kUnitCount * sizeof(Neighborhood), q);
+    Lbvh lbvh = AllocateLbvh(q);
+    SweepAndPrune sweepAndPrune = AllocateSweepAndPrune(q);
+    FusedGrid fusedGrid = AllocateFusedGrid(q);
+
+    q.submit([&](handler& h) {
+        h.memcpy(gpuBoids, &cpuBoids, sizeof(Boids));}).wait();
+
+    int frameNumber = 0;
+    auto renderFrame = [&](const Settings& frameSettings) {
+        RenderFrame(q, flockingKernels, frameSettings, frameNumber++, gpuBoids, grid, sortScratch, neighborList, pairSums, lbvh, sweepAndPrune, fusedGrid, temporaryPositions, temporaryVelocities, temporaryIds, mousePointer);
+    };
+    auto resetState = [&]() {
+        grid.Invalidate();
+        neighborList.valid = false;
+        *neighborList.overflowCount = 0;
+        fusedGrid.valid = false;
+    };
+
+    // Tune and benchmark without the mouse pointer in range
+    mousePointer->x = -2 * kVisualRange;
+    mousePointer->y = -2 * kVisualRange;
+    if (settings.tuneCellDivisions)
+    {
+        settings.cellDivisions = TuneCellDivisions(q, settings, gpuBoids, renderFrame, resetState);
+        frameNumber = 0;
+    }
+    if (settings.fastMath)
+    {
+        ReportMathAccuracy(q, settings, gpuBoids, renderFrame, resetState);
+        frameNumber = 0;
+    }
+
+    int result = 0;
+    if (settings.benchmark == BenchmarkMode::Clustered)
+        RunClusteredBenchmark(q, settings, gpuBoids, renderFrame, resetState);
+    else
+    {
+        // The host engine follows every boid within kVisualRange, the topological mode stays on the device.
+        // An engine that does not match the device leaves the frame to the device.
+        std::unique_ptr<HostEngine> hostEngine;
+        if (settings.engine == Engine::Host && settings.nearestNeighbors == 0)
+        {
+            hostEngine.reset(new HostEngine(settings.hostIsa));
+            if (!ReportHostAccuracy(q, settings, *hostEngine, gpuBoids, mousePointer, renderFrame, resetState))
+                hostEngine.reset();
+        }
+        if (hostEngine)
+            result = RunWindow(q, cpuBoids, nullptr, mousePointer, [&]() { hostEngine->Step(settings, cpuBoids, mousePointer); });
+        else
+            result = RunWindow(q, cpuBoids, gpuBoids, mousePointer, [&]() { renderFrame(settings); });
+    }
+    grid.Report();
 
     free(gpuBoids, q);
-    free(particlesGrid, q);
+    FreeSortScratch(q, sortScratch);
     free(temporaryPositions, q);
     free(temporaryVelocities, q);
-    free(cellStart, q);
+    free(temporaryIds, q);
+    FreeNeighborList(q, neighborList);
+    free(pairSums, q);
+    FreeLbvh(q, lbvh);
+    FreeSweepAndPrune(q, sweepAndPrune);
+    FreeFusedGrid(q, fusedGrid);
     free(mousePointer, q);
-    return 0;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef MATH_ACCURACY_H
+#define MATH_ACCURACY_H
+#include <CL/sycl.hpp>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstdio>
+#include "boids.h"
+#include "settings.h"
+
+namespace
+{
+    constexpr int kAccuracyCheckpoints[] = { 1, 10, 100 };
+    constexpr int kAccuracyFrames = 100;
+
+    // Positions and velocities indexed by external id, the device order changes with reordering
+    std::vector<float> StateById(const Boids& boids)
+    {
+        std::vector<float> state(4 * kUnitCount);
+        for (size_t k = 0; k < kUnitCount; k++)
+        {
+            int id = boids.ids[k];
+            state[4 * id] = boids.positions.x[k];
+            state[4 * id + 1] = boids.positions.y[k];
+            state[4 * id + 2] = boids.velocities.vx[k];
+            state[4 * id + 3] = boids.velocities.vy[k];
+        }
+        return state;
+    }
+
+    std::vector<float> StateById(sycl::queue& q, const Boids* boids)
+    {
+        std::unique_ptr<Boids> hostBoids(new Boids);
+        q.memcpy(hostBoids.get(), boids, sizeof(Boids)).wait();
+        return StateById(*hostBoids);
+    }
+
+    // Runs kAccuracyFrames from the current flock with the exact and the fast-math kernels and prints how far
+    // the fast trajectories drift from the exact ones, then restores the flock. Flocking is chaotic, single
+    // boids that take another branch at a range boundary diverge while the mean error stays small.
+    // renderFrame(settings) renders one frame, resetState() drops state carried between frames.
+    template <typename FrameFunc, typename ResetFunc>
+    void ReportMathAccuracy(sycl::queue& q, const Settings& settings, Boids* boids, FrameFunc renderFrame, ResetFunc resetState)
+    {
+        Boids* snapshot = (Boids*)sycl::malloc_device(sizeof(Boids), q);
+        q.memcpy(snapshot, boids, sizeof(Boids)).wait();
+
+        Settings exact = settings;
+        exact.fastMath = false;
+        Settings fast = settings;
+        fast.fastMath = true;
+
+        std::vector<std::vector<float>> exactStates;
+        resetState();
+        for (int frame = 1; frame <= kAccuracyFrames; frame++)
+        {
+            renderFrame(exact);
+            for (int checkpoint : kAccuracyCheckpoints)
+                if (frame == checkpoint)
+                    exactStates.push_back(StateById(q, boids));
+        }
+
+        printf("Fast math accuracy against the exact kernels\n");
+        printf("%-8s %16s %16s %18s %18s\n", "frames", "mean position", "max position", "mean velocity", "max velocity");
+        q.memcpy(boids, snapshot, sizeof(Boids)).wait();
+        resetState();
+        size_t next = 0;
+        for (int frame = 1; frame <= kAccuracyFrames; frame++)
+        {
+            renderFrame(fast);
+            if (next >= exactStates.size() || frame != kAccuracyCheckpoints[next])
+                continue;
+            std::vector<float> state = StateById(q, boids);
+            const std::vector<float>& reference = exactStates[next++];
+            double meanPosition = 0.0, maxPosition = 0.0, meanVelocity = 0.0, maxVelocity = 0.0;
+            for (size_t id = 0; id < kUnitCount; id++)
+            {
+                double position = std::hypot(state[4 * id] - reference[4 * id], state[4 * id + 1] - reference[4 * id + 1]);
+                double velocity = std::hypot(state[4 * id + 2] - reference[4 * id + 2], state[4 * id + 3] - reference[4 * id + 3]);
+                meanPosition += position / kUnitCount;
+                meanVelocity += velocity / kUnitCount;
+                maxPosition = position > maxPosition ? position : maxPosition;
+                maxVelocity = velocity > maxVelocity ? velocity : maxVelocity;
+            }
+            printf("%-8d %16.3g %16.3g %18.3g %18.3g\n", frame, meanPosition, maxPosition, meanVelocity, maxVelocity);
+        }
+
+        q.memcpy(boids, snapshot, sizeof(Boids)).wait();
+        resetState();
+        sycl::free(snapshot, q);
+    }
+}
+#endif
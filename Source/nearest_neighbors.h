@@ -0,0 +1,149 @@
+#ifndef NEAREST_NEIGHBORS_H
+#define NEAREST_NEIGHBORS_H
+#include <CL/sycl.hpp>
+#include <cfloat>
+#include "boids.h"
+#include "flocking.h"
+#include "spatial_grid.h"
+
+// Bounded max-heap of the nearest candidates seen so far, the farthest on top
+struct NeighborHeap
+{
+    float distances[kMaxNearestNeighbors];  // squared
+    int ids[kMaxNearestNeighbors];
+    int size = 0;
+};
+
+namespace
+{
+    // Keeps the capacity nearest of all pushed candidates
+    inline void PushNeighbor(NeighborHeap& heap, int capacity, float distance, int j)
+    {
+        int slot;
+        if (heap.size < capacity)
+        {
+            // Sift up from a new leaf
+            slot = heap.size++;
+            while (slot > 0 && heap.distances[(slot - 1) / 2] < distance)
+            {
+                int parent = (slot - 1) / 2;
+                heap.distances[slot] = heap.distances[parent];
+                heap.ids[slot] = heap.ids[parent];
+                slot = parent;
+            }
+        }
+        else
+        {
+            if (distance >= heap.distances[0])
+                return;
+
+            // Replace the farthest and sift down
+            slot = 0;
+            while (true)
+            {
+                int child = 2 * slot + 1;
+                if (child >= heap.size)
+                    break;
+                if (child + 1 < heap.size && heap.distances[child + 1] > heap.distances[child])
+                    child++;
+                if (heap.distances[child] <= distance)
+                    break;
+                heap.distances[slot] = heap.distances[child];
+                heap.ids[slot] = heap.ids[child];
+                slot = child;
+            }
+        }
+        heap.distances[slot] = distance;
+        heap.ids[slot] = j;
+    }
+
+    // Topological flocking: every boid follows its nearestCount nearest neighbors whatever their distance,
+    // with the same alignment, cohesion and separation terms as the metric rule.
+    // search(i, x, y, heap) pushes at least the nearestCount nearest boids of boid i at (x, y) into heap.
+    template <typename Site, typename SearchFunc>
+    void NearestFlockingStep(FlockingKernels& kernels, Boids* boids, int nearestCount, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules, SearchFunc search)
+    {
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            kernels.Submit(rules.parameters, [&](sycl::handler& h) {
+                h.parallel_for<FlockingKernel<Site, Rules>>(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> id, sycl::kernel_handler kh) {
+                    int i = id;
+                    float x = boids->positions.x[i];
+                    float y = boids->positions.y[i];
+                    NeighborHeap heap;
+                    search(i, x, y, heap);
+
+                    Neighborhood neighborhood;
+                    for (int n = 0; n < heap.size; n++)
+                        AddNeighborAt(neighborhood, boids, x, y, heap.ids[n], RangeMeasure<FastMath>(heap.distances[n]) < RangeLimit<FastMath>(kProtectedRange));
+                    UpdateBoid<Rules>(boids, i, neighborhood, SpecializedParameters(kh), mousePointer, temporaryPositions, temporaryVelocities);
+                    });
+                }).wait();
+            });
+    }
+
+    // Topological flocking over a grid. Rings of cells around the boid are scanned outwards until the heap
+    // is full and its farthest entry is closer than any cell not scanned yet, so dense clusters cost no more
+    // than sparse regions.
+    // Cells that the grid bounds rule out are skipped. A bounded grid keeps every boid in its window cells,
+    // so the search also ends once the block reaches the window edge on every side. A hashed grid has no
+    // edge, and there are always enough boids to fill the heap.
+    void NearestNeighborStep(FlockingKernels& kernels, Boids* boids, const GridView& grid, int nearestCount, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        GridView view = grid;
+        GridLayout cells = grid.layout;
+        bool bounded = !cells.hashed;
+
+        NearestFlockingStep<NearestGridSite>(kernels, boids, nearestCount, mousePointer, temporaryPositions, temporaryVelocities, rules, [=](int i, float x, float y, NeighborHeap& heap) {
+            int col, row;
+            CellCoordinates(cells, x, y, col, row);
+            for (int ring = 0; ; ring++)
+            {
+                for (int r = row - ring; r <= row + ring; r++)
+                {
+                    // Inner rows of a ring only have their first and last cell
+                    int step = (r == row - ring || r == row + ring) ? 1 : 2 * ring;
+                    for (int c = col - ring; c <= col + ring; c += step)
+                    {
+                        if (!CellInGrid(cells, c, r))
+                            continue;
+                        // Once the heap is full only cells that may hold a closer boid matter
+                        int cell = CellId(cells, c, r);
+                        float range = heap.size == nearestCount ? sqrt(heap.distances[0]) : FLT_MAX;
+                        if (!CellMayHold(view.bounds, cell, x, y, range))
+                            continue;
+                        view.ForEachInCell(cell, [&](int j) {
+                            if (j == i)
+                                return;
+                            float xFriend = boids->positions.x[j];
+                            float yFriend = boids->positions.y[j];
+                            // A hash bucket may hold other cells, take every boid in its own cell only
+                            if (cells.hashed)
+                            {
+                                int colFriend, rowFriend;
+                                CellCoordinates(cells, xFriend, yFriend, colFriend, rowFriend);
+                                if (colFriend != c || rowFriend != r)
+                                    return;
+                            }
+                            PushNeighbor(heap, nearestCount, (xFriend - x) * (xFriend - x) + (yFriend - y) * (yFriend - y), j);
+                            });
+                    }
+                }
+
+                // Every boid outside the scanned block is at least covered away. Bounded grids clamp boids outside
+                // the window into the border cells, so no boid lies beyond a side of the block at the window edge.
+                float left = bounded && col - ring <= 0 ? FLT_MAX : x - (col - ring) * cells.cellSize;
+                float right = bounded && col + ring >= cells.cols - 1 ? FLT_MAX : (col + ring + 1) * cells.cellSize - x;
+                float top = bounded && row - ring <= 0 ? FLT_MAX : y - (row - ring) * cells.cellSize;
+                float bottom = bounded && row + ring >= cells.rows - 1 ? FLT_MAX : (row + ring + 1) * cells.cellSize - y;
+                float covered = sycl::min(sycl::min(left, right), sycl::min(top, bottom));
+                if (covered == FLT_MAX || (heap.size == nearestCount && heap.distances[0] <= covered * covered))
+                    break;
+            }
+            });
+    }
+}
+#endif
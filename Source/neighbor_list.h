@@ -0,0 +1,92 @@
+#ifndef NEIGHBOR_LIST_H
+#define NEIGHBOR_LIST_H
+#include <CL/sycl.hpp>
+#include <cfloat>
+#include "boids.h"
+#include "flocking.h"
+#include "spatial_grid.h"
+
+// Verlet lists: every boid keeps the candidates within kVisualRange + skin
+struct NeighborList
+{
+    int* neighbors;                 // capacity slots per boid
+    int* counts;                    // candidates found per boid, above capacity the boid falls back to the grid
+    unsigned int* overflowCount;    // shared, boids whose list overflowed at the last build
+    int capacity;
+    int age = 0;                    // frames since the last build
+    bool valid = false;
+};
+
+namespace
+{
+    NeighborList AllocateNeighborList(sycl::queue& q, int capacity)
+    {
+        NeighborList list;
+        list.capacity = capacity;
+        list.neighbors = (int*)sycl::malloc_device(kUnitCount * (size_t)capacity * sizeof(int), q);
+        list.counts = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        list.overflowCount = (unsigned int*)sycl::malloc_shared(sizeof(unsigned int), q);
+        *list.overflowCount = 0;
+        return list;
+    }
+
+    void FreeNeighborList(sycl::queue& q, NeighborList& list)
+    {
+        sycl::free(list.neighbors, q);
+        sycl::free(list.counts, q);
+        sycl::free(list.overflowCount, q);
+    }
+
+    // Fastest a boid moves in one frame. Without the speed clamp there is no bound, and a boid that wraps
+    // crosses the window in one frame, so either rebuilds the lists every frame.
+    inline float MaxFrameSpeed(const FlockingRules& rules)
+    {
+        if (!rules.speedClamp || rules.wrap)
+            return FLT_MAX;
+        return sycl::max(rules.parameters.maxSpeed, rules.parameters.minSpeed);
+    }
+
+    // Boids move at most maxSpeed per frame, so a pair closes in by at most 2 * maxSpeed.
+    // The list stays exact while that accumulated approach is within the skin.
+    bool NeighborListExpired(const NeighborList& list, float skin, float maxSpeed)
+    {
+        return !list.valid || maxSpeed * (2.0f * list.age) > skin;
+    }
+
+    // Collects the neighbors within kVisualRange + skin of every boid from a freshly built grid
+    void BuildNeighborList(sycl::queue& q, Boids* boids, const GridView& grid, NeighborList& list, float skin)
+    {
+        int* neighbors = list.neighbors;
+        int* counts = list.counts;
+        unsigned int* overflowCount = list.overflowCount;
+        int capacity = list.capacity;
+        float range = kVisualRange + skin;
+        GridView cells = grid;
+
+        *overflowCount = 0;
+        q.parallel_for(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> id) {
+            int i = id;
+            float x = boids->positions.x[i];
+            float y = boids->positions.y[i];
+            int count = 0;
+            cells.ForEachNeighbor(boids, i, range, [&](int j) {
+                if (j == i || Distance(x, y, boids->positions.x[j], boids->positions.y[j]) > range)
+                    return;
+                if (count < capacity)
+                    neighbors[i * capacity + count] = j;
+                count++;
+                });
+            counts[i] = count;
+            if (count > capacity)
+            {
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                    sycl::access::address_space::global_space> overflow(*overflowCount);
+                overflow.fetch_add(1u);
+            }
+            }).wait();
+
+        list.age = 0;
+        list.valid = true;
+    }
+}
+#endif
@@ -0,0 +1,171 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+#include <CL/sycl.hpp>
+#include <utility>
+
+namespace
+{
+    constexpr unsigned kRadixBits = 4;
+    constexpr unsigned kRadixBuckets = 1 << kRadixBits;
+    constexpr unsigned kRadixMask = kRadixBuckets - 1;
+    constexpr size_t   kSortBlockSize = 256;
+
+    // Device scratch shared by ExclusiveScan and the radix sort passes
+    struct SortScratch
+    {
+        unsigned int* counts;
+        unsigned int* blockSums;
+        unsigned int* blockOffsets;
+        size_t capacity;
+    };
+
+    size_t BlocksFor(size_t n)
+    {
+        return (n + kSortBlockSize - 1) / kSortBlockSize;
+    }
+
+    SortScratch AllocateSortScratch(sycl::queue& q, size_t maxItems)
+    {
+        SortScratch scratch;
+        size_t countsSize = kRadixBuckets * BlocksFor(maxItems);
+        size_t scanBlocks = BlocksFor(countsSize > maxItems ? countsSize : maxItems);
+        scratch.capacity = maxItems;
+        scratch.counts = (unsigned int*)sycl::malloc_device(countsSize * sizeof(unsigned int), q);
+        scratch.blockSums = (unsigned int*)sycl::malloc_device(scanBlocks * sizeof(unsigned int), q);
+        scratch.blockOffsets = (unsigned int*)sycl::malloc_device(scanBlocks * sizeof(unsigned int), q);
+        return scratch;
+    }
+
+    void FreeSortScratch(sycl::queue& q, SortScratch& scratch)
+    {
+        sycl::free(scratch.counts, q);
+        sycl::free(scratch.blockSums, q);
+        sycl::free(scratch.blockOffsets, q);
+    }
+
+    // Device-wide exclusive prefix sum: per-block sums, scan of the block sums
+    // in a single work-group, then per-block scans offset by the block prefix.
+    // in and out may alias; n must not exceed the scratch capacity.
+    void ExclusiveScan(sycl::queue& q, const unsigned int* in, unsigned int* out, size_t n, SortScratch& scratch)
+    {
+        size_t numBlocks = BlocksFor(n);
+        unsigned int* blockSums = scratch.blockSums;
+        unsigned int* blockOffsets = scratch.blockOffsets;
+        sycl::nd_range<1> blocks{ sycl::range<1>(numBlocks * kSortBlockSize), sycl::range<1>(kSortBlockSize) };
+
+        q.parallel_for(blocks, [=](sycl::nd_item<1> it) {
+            size_t i = it.get_global_id(0);
+            unsigned int value = i < n ? in[i] : 0;
+            unsigned int sum = sycl::reduce_over_group(it.get_group(), value, sycl::plus<unsigned int>());
+            if (it.get_local_id(0) == 0)
+                blockSums[it.get_group_linear_id()] = sum;
+            }).wait();
+
+        q.parallel_for(sycl::nd_range<1>{ sycl::range<1>(kSortBlockSize), sycl::range<1>(kSortBlockSize) }, [=](sycl::nd_item<1> it) {
+            sycl::joint_exclusive_scan(it.get_group(), blockSums, blockSums + numBlocks, blockOffsets, 0u, sycl::plus<unsigned int>());
+            }).wait();
+
+        q.parallel_for(blocks, [=](sycl::nd_item<1> it) {
+            size_t i = it.get_global_id(0);
+            unsigned int value = i < n ? in[i] : 0;
+            unsigned int prefix = sycl::exclusive_scan_over_group(it.get_group(), value, sycl::plus<unsigned int>());
+            if (i < n)
+                out[i] = prefix + blockOffsets[it.get_group_linear_id()];
+            }).wait();
+    }
+
+    // One stable counting pass over a kRadixBits digit.
+    // digit(i) returns the digit of source element i, move(i, j) writes source element i to slot j.
+    // Block histograms are stored digit-major, so one exclusive scan yields every block's
+    // output offset per digit and preserves the input order inside each digit.
+    template <typename DigitFunc, typename MoveFunc>
+    void RadixSortPass(sycl::queue& q, size_t n, DigitFunc digit, MoveFunc move, SortScratch& scratch)
+    {
+        size_t numBlocks = BlocksFor(n);
+        unsigned int* counts = scratch.counts;
+        sycl::nd_range<1> blocks{ sycl::range<1>(numBlocks * kSortBlockSize), sycl::range<1>(kSortBlockSize) };
+
+        q.submit([&](sycl::handler& h) {
+            sycl::local_accessor<unsigned int, 1> histogram(sycl::range<1>(kRadixBuckets), h);
+            h.parallel_for(blocks, [=](sycl::nd_item<1> it) {
+                size_t i = it.get_global_id(0);
+                size_t local = it.get_local_id(0);
+                if (local < kRadixBuckets)
+                    histogram[local] = 0;
+                sycl::group_barrier(it.get_group());
+                if (i < n)
+                {
+                    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::work_group,
+                        sycl::access::address_space::local_space> bucket(histogram[digit(i)]);
+                    bucket.fetch_add(1u);
+                }
+                sycl::group_barrier(it.get_group());
+                if (local < kRadixBuckets)
+                    counts[local * numBlocks + it.get_group_linear_id()] = histogram[local];
+                });
+            }).wait();
+
+        ExclusiveScan(q, counts, counts, kRadixBuckets * numBlocks, scratch);
+
+        q.parallel_for(blocks, [=](sycl::nd_item<1> it) {
+            size_t i = it.get_global_id(0);
+            size_t block = it.get_group_linear_id();
+            unsigned int d = i < n ? digit(i) : kRadixBuckets;
+            for (unsigned int bucket = 0; bucket < kRadixBuckets; bucket++)
+            {
+                unsigned int flag = d == bucket ? 1 : 0;
+                unsigned int rank = sycl::exclusive_scan_over_group(it.get_group(), flag, sycl::plus<unsigned int>());
+                if (flag)
+                    move(i, counts[bucket * numBlocks + block] + rank);
+            }
+            }).wait();
+    }
+
+    // LSD radix sort of data[0..n) by the low keyBits bits of key(element).
+    // temp must hold n elements; the result always ends up in data.
+    template <typename T, typename KeyFunc>
+    void RadixSort(sycl::queue& q, T* data, T* temp, size_t n, unsigned keyBits, KeyFunc key, SortScratch& scratch)
+    {
+        T* src = data;
+        T* dst = temp;
+        for (unsigned shift = 0; shift < keyBits; shift += kRadixBits)
+        {
+            RadixSortPass(q, n,
+                [=](size_t i) { return (unsigned int)((key(src[i]) >> shift) & kRadixMask); },
+                [=](size_t i, size_t j) { dst[j] = src[i]; },
+                scratch);
+            std::swap(src, dst);
+        }
+        if (src != data)
+            q.memcpy(data, src, n * sizeof(T)).wait();
+    }
+
+    // LSD radix sort of keys[0..n) carrying values along, by the low keyBits bits of each key.
+    template <typename Key, typename Value>
+    void RadixSortByKey(sycl::queue& q, Key* keys, Value* values, Key* keysTemp, Value* valuesTemp, size_t n, unsigned keyBits, SortScratch& scratch)
+    {
+        Key* keysSrc = keys;
+        Key* keysDst = keysTemp;
+        Value* valuesSrc = values;
+        Value* valuesDst = valuesTemp;
+        for (unsigned shift = 0; shift < keyBits; shift += kRadixBits)
+        {
+            RadixSortPass(q, n,
+                [=](size_t i) { return (unsigned int)((keysSrc[i] >> shift) & kRadixMask); },
+                [=](size_t i, size_t j) {
+                    keysDst[j] = keysSrc[i];
+                    valuesDst[j] = valuesSrc[i];
+                },
+                scratch);
+            std::swap(keysSrc, keysDst);
+            std::swap(valuesSrc, valuesDst);
+        }
+        if (keysSrc != keys)
+        {
+            q.memcpy(keys, keysSrc, n * sizeof(Key));
+            q.memcpy(values, valuesSrc, n * sizeof(Value));
+            q.wait();
+        }
+    }
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef REORDER_H
+#define REORDER_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+
+namespace
+{
+    // Permutes positions, velocities and external ids into the order of groupedGrid,
+    // so boids of one cell are contiguous, then points groupedGrid at the new slots.
+    // Cell bounds of the grid stay valid.
+    void ReorderBoids(sycl::queue& q, Boids* boids, IdPair* groupedGrid,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, int* temporaryIds)
+    {
+        sycl::range<1> numItems{ kUnitCount };
+
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            int j = groupedGrid[k].id;
+            temporaryPositions->x[k] = boids->positions.x[j];
+            temporaryPositions->y[k] = boids->positions.y[j];
+            temporaryVelocities->vx[k] = boids->velocities.vx[j];
+            temporaryVelocities->vy[k] = boids->velocities.vy[j];
+            temporaryIds[k] = boids->ids[j];
+            }).wait();
+
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            boids->positions.x[k] = temporaryPositions->x[k];
+            boids->positions.y[k] = temporaryPositions->y[k];
+            boids->velocities.vx[k] = temporaryVelocities->vx[k];
+            boids->velocities.vy[k] = temporaryVelocities->vy[k];
+            boids->ids[k] = temporaryIds[k];
+            groupedGrid[k].id = k;
+            }).wait();
+    }
+}
+#endif
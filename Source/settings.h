@@ -0,0 +1,272 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+#include <string>
+#include <iostream>
+#include "constants.h"
+
+enum class SortMethod
+{
+    Radix,  // LSD radix sort on the device
+    Host    // recursive QuickSort on the host
+};
+
+enum class SortKey
+{
+    Packed, // (cellId << id bits) | id in one word, the radix sort moves half the bytes
+    Pair    // IdPair structs sorted by their cellId field
+};
+
+enum class GridMethod
+{
+    Sort,           // sort particlesGrid by cellId, then find cell bounds
+    Incremental,    // repair last frame's sorted grid, full sort only above the migration threshold
+    Counting,       // histogram, exclusive scan and scatter, no comparison sort
+    Linked,         // per-cell linked lists built with atomic exchanges
+    Bucket,         // fixed slots per cell filled with atomic counters, plus a shared overflow list
+    Hash,           // counting sort into a fixed-size spatial hash table, the world is unbounded
+    Bvh,            // linear BVH built from Morton codes, no grid
+    Sweep,          // boids sorted along the axis of largest variance, neighbors found in a kVisualRange window
+    Auto            // sweep while the flock is stretched along one axis, the sort grid otherwise
+};
+
+enum class FlockingMethod
+{
+    Gather,     // every boid gathers its own neighbors, each pair is evaluated from both sides
+    Symmetric,  // half stencil over colored cells, each pair is evaluated once for both boids
+    Tiled,      // one work-group per cell, neighbor tiles staged in local memory
+    SubGroup    // one sub-group per boid, the lanes split its candidates
+};
+
+enum class Engine
+{
+    Device,     // SYCL kernels on the queue's device
+    Host        // native SIMD loop on the host, no SYCL launches per frame
+};
+
+enum class HostIsa
+{
+    Auto,       // widest instruction set the processor supports
+    Scalar,
+    Avx2,       // 8 candidates per iteration
+    Avx512      // 16 candidates per iteration
+};
+
+enum class EdgeMode
+{
+    Margins,    // boids turn back inside kMarginSize of the window edges
+    Wrap        // boids leaving the window reenter on the opposite side
+};
+
+enum class CellOrdering
+{
+    RowMajor,   // col + row * kGridColsNum
+    Morton,     // Z-order curve
+    Hilbert     // Hilbert curve
+};
+
+enum class BenchmarkMode
+{
+    None,       // run the simulation
+    Ordering,   // compare cell orderings on a large synthetic grid and exit
+    Clustered   // time the grids and the BVH on clumped flocks and exit
+};
+
+// Tuning factors of the flocking rules, the kernels receive them as specialization constants
+struct FlockingParameters
+{
+    float turnFactor = kTurnFactor;
+    float centeringFactor = kCenteringFactor;
+    float avoidFactor = kAvoidFactor;
+    float alignFactor = kAlignFactor;
+    float maxSpeed = kMaxSpeed;
+    float minSpeed = kMinSpeed;
+    float mouseFactor = kMouseFactor;
+
+    bool operator==(const FlockingParameters& other) const
+    {
+        return turnFactor == other.turnFactor && centeringFactor == other.centeringFactor && avoidFactor == other.avoidFactor &&
+            alignFactor == other.alignFactor && maxSpeed == other.maxSpeed && minSpeed == other.minSpeed && mouseFactor == other.mouseFactor;
+    }
+};
+
+struct Settings
+{
+    SortMethod sortMethod = SortMethod::Radix;
+    SortKey sortKey = SortKey::Packed;
+    GridMethod gridMethod = GridMethod::Sort;
+    CellOrdering cellOrdering = CellOrdering::RowMajor;
+    FlockingMethod flockingMethod = FlockingMethod::Gather;
+    unsigned int migrationThreshold = kUnitCount / 20;  // incremental grid falls back to a full sort above this many cell changes
+    float neighborSkin = 0.0f;  // Verlet list margin beyond kVisualRange, 0 disables the lists
+    int neighborCapacity = 768; // Verlet list slots per boid, boids with more candidates use the grid
+    int reorderInterval = 0;    // frames between moving boids into cell order, 0 disables, linked and bucket grids never reorder
+    int nearestNeighbors = 0;   // topological mode follows this many nearest boids, 0 follows every boid within kVisualRange
+    bool cellCulling = false;   // skip stencil cells that are empty or farther than the search range
+    int cellDivisions = 1;      // cells are kVisualRange / cellDivisions wide
+    bool tuneCellDivisions = false; // time every cell division at startup and keep the fastest
+    bool fastMath = false;      // squared range tests and rsqrt in the flocking kernels instead of sqrt
+    bool mouseAvoidance = true; // boids flee the mouse pointer
+    EdgeMode edges = EdgeMode::Margins;
+    bool speedClamp = true;     // keep speeds between minSpeed and maxSpeed
+    FlockingParameters parameters;
+    Engine engine = Engine::Device;
+    HostIsa hostIsa = HostIsa::Auto;    // capped at what the processor supports
+    bool fusedFrame = false;    // flocking bins the next grid, the frame waits once
+    BenchmarkMode benchmark = BenchmarkMode::None;
+};
+
+// Rules and arithmetic of the flocking kernels, every combination is compiled as its own kernel
+struct FlockingRules
+{
+    bool fastMath = false;
+    bool mouseAvoidance = true;
+    bool wrap = false;
+    bool speedClamp = true;
+    FlockingParameters parameters;
+};
+
+namespace
+{
+    FlockingRules RulesOf(const Settings& settings)
+    {
+        FlockingRules rules;
+        rules.fastMath = settings.fastMath;
+        rules.mouseAvoidance = settings.mouseAvoidance;
+        rules.wrap = settings.edges == EdgeMode::Wrap;
+        rules.speedClamp = settings.speedClamp;
+        rules.parameters = settings.parameters;
+        return rules;
+    }
+
+    // Matches "--name=value" and stores value
+    bool ReadOption(const std::string& arg, const std::string& name, std::string& value)
+    {
+        std::string prefix = "--" + name + "=";
+        if (arg.compare(0, prefix.size(), prefix) != 0)
+            return false;
+        value = arg.substr(prefix.size());
+        return true;
+    }
+
+    Settings ParseSettings(int argc, char* argv[])
+    {
+        Settings settings;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            std::string value;
+            if (ReadOption(arg, "sort", value) && value == "radix")
+                settings.sortMethod = SortMethod::Radix;
+            else if (ReadOption(arg, "sort", value) && value == "host")
+                settings.sortMethod = SortMethod::Host;
+            else if (ReadOption(arg, "sort-key", value) && value == "packed")
+                settings.sortKey = SortKey::Packed;
+            else if (ReadOption(arg, "sort-key", value) && value == "pair")
+                settings.sortKey = SortKey::Pair;
+            else if (ReadOption(arg, "grid", value) && value == "sort")
+                settings.gridMethod = GridMethod::Sort;
+            else if (ReadOption(arg, "grid", value) && value == "incremental")
+                settings.gridMethod = GridMethod::Incremental;
+            else if (ReadOption(arg, "migration-threshold", value) && std::stoi(value) >= 1)
+                settings.migrationThreshold = std::stoi(value);
+            else if (ReadOption(arg, "grid", value) && value == "counting")
+                settings.gridMethod = GridMethod::Counting;
+            else if (ReadOption(arg, "grid", value) && value == "linked")
+                settings.gridMethod = GridMethod::Linked;
+            else if (ReadOption(arg, "grid", value) && value == "bucket")
+                settings.gridMethod = GridMethod::Bucket;
+            else if (ReadOption(arg, "grid", value) && value == "hash")
+                settings.gridMethod = GridMethod::Hash;
+            else if (ReadOption(arg, "grid", value) && value == "bvh")
+                settings.gridMethod = GridMethod::Bvh;
+            else if (ReadOption(arg, "grid", value) && value == "sweep")
+                settings.gridMethod = GridMethod::Sweep;
+            else if (ReadOption(arg, "grid", value) && value == "auto")
+                settings.gridMethod = GridMethod::Auto;
+            else if (ReadOption(arg, "flocking", value) && value == "gather")
+                settings.flockingMethod = FlockingMethod::Gather;
+            else if (ReadOption(arg, "flocking", value) && value == "symmetric")
+                settings.flockingMethod = FlockingMethod::Symmetric;
+            else if (ReadOption(arg, "flocking", value) && value == "tiled")
+                settings.flockingMethod = FlockingMethod::Tiled;
+            else if (ReadOption(arg, "flocking", value) && value == "subgroup")
+                settings.flockingMethod = FlockingMethod::SubGroup;
+            else if (ReadOption(arg, "neighbor-skin", value) && std::stof(value) >= 0.0f)
+                settings.neighborSkin = std::stof(value);
+            else if (ReadOption(arg, "neighbor-capacity", value) && std::stoi(value) >= 1)
+                settings.neighborCapacity = std::stoi(value);
+            else if (ReadOption(arg, "cell-order", value) && value == "row")
+                settings.cellOrdering = CellOrdering::RowMajor;
+            else if (ReadOption(arg, "cell-order", value) && value == "morton")
+                settings.cellOrdering = CellOrdering::Morton;
+            else if (ReadOption(arg, "cell-order", value) && value == "hilbert")
+                settings.cellOrdering = CellOrdering::Hilbert;
+            else if (ReadOption(arg, "reorder", value))
+                settings.reorderInterval = std::stoi(value);
+            else if (ReadOption(arg, "nearest", value) && std::stoi(value) >= 0 && std::stoi(value) <= kMaxNearestNeighbors)
+                settings.nearestNeighbors = std::stoi(value);
+            else if (ReadOption(arg, "cell-culling", value) && value == "on")
+                settings.cellCulling = true;
+            else if (ReadOption(arg, "cell-culling", value) && value == "off")
+                settings.cellCulling = false;
+            else if (ReadOption(arg, "cell-divisions", value) && value == "auto")
+                settings.tuneCellDivisions = true;
+            else if (ReadOption(arg, "cell-divisions", value) && std::stoi(value) >= 1 && std::stoi(value) <= kMaxCellDivisions)
+                settings.cellDivisions = std::stoi(value);
+            else if (ReadOption(arg, "math", value) && value == "exact")
+                settings.fastMath = false;
+            else if (ReadOption(arg, "math", value) && value == "fast")
+                settings.fastMath = true;
+            else if (ReadOption(arg, "mouse", value) && value == "on")
+                settings.mouseAvoidance = true;
+            else if (ReadOption(arg, "mouse", value) && value == "off")
+                settings.mouseAvoidance = false;
+            else if (ReadOption(arg, "edges", value) && value == "margins")
+                settings.edges = EdgeMode::Margins;
+            else if (ReadOption(arg, "edges", value) && value == "wrap")
+                settings.edges = EdgeMode::Wrap;
+            else if (ReadOption(arg, "speed-clamp", value) && value == "on")
+                settings.speedClamp = true;
+            else if (ReadOption(arg, "speed-clamp", value) && value == "off")
+                settings.speedClamp = false;
+            else if (ReadOption(arg, "turn-factor", value))
+                settings.parameters.turnFactor = std::stof(value);
+            else if (ReadOption(arg, "centering-factor", value))
+                settings.parameters.centeringFactor = std::stof(value);
+            else if (ReadOption(arg, "avoid-factor", value))
+                settings.parameters.avoidFactor = std::stof(value);
+            else if (ReadOption(arg, "align-factor", value))
+                settings.parameters.alignFactor = std::stof(value);
+            else if (ReadOption(arg, "max-speed", value))
+                settings.parameters.maxSpeed = std::stof(value);
+            else if (ReadOption(arg, "min-speed", value))
+                settings.parameters.minSpeed = std::stof(value);
+            else if (ReadOption(arg, "mouse-factor", value))
+                settings.parameters.mouseFactor = std::stof(value);
+            else if (ReadOption(arg, "engine", value) && value == "device")
+                settings.engine = Engine::Device;
+            else if (ReadOption(arg, "engine", value) && value == "host")
+                settings.engine = Engine::Host;
+            else if (ReadOption(arg, "host-isa", value) && value == "auto")
+                settings.hostIsa = HostIsa::Auto;
+            else if (ReadOption(arg, "host-isa", value) && value == "scalar")
+                settings.hostIsa = HostIsa::Scalar;
+            else if (ReadOption(arg, "host-isa", value) && value == "avx2")
+                settings.hostIsa = HostIsa::Avx2;
+            else if (ReadOption(arg, "host-isa", value) && value == "avx512")
+                settings.hostIsa = HostIsa::Avx512;
+            else if (ReadOption(arg, "fused-frame", value) && value == "on")
+                settings.fusedFrame = true;
+            else if (ReadOption(arg, "fused-frame", value) && value == "off")
+                settings.fusedFrame = false;
+            else if (ReadOption(arg, "benchmark", value) && value == "ordering")
+                settings.benchmark = BenchmarkMode::Ordering;
+            else if (ReadOption(arg, "benchmark", value) && value == "clustered")
+                settings.benchmark = BenchmarkMode::Clustered;
+            else
+                std::cout << "Unknown option " << arg << std::endl;
+        }
+        return settings;
+    }
+}
+#endif
@@ -0,0 +1,421 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+#include <CL/sycl.hpp>
+#include <type_traits>
+#include "boids.h"
+#include "settings.h"
+#include "cell_order.h"
+#include "radix_sort.h"
+#include "cell_binning.h"
+#include "linked_cells.h"
+#include "cell_buckets.h"
+#include "incremental_grid.h"
+#include "cell_bounds.h"
+
+namespace
+{
+    // (col, row) offsets of the 3x3 stencil that cells kVisualRange wide need
+    constexpr int kStencilCells = 9;
+    constexpr int kStencilOffsets[kStencilCells][2] = {
+        { -1, -1 }, { 0, -1 }, { 1, -1 },
+        { -1,  0 }, { 0,  0 }, { 1,  0 },
+        { -1,  1 }, { 0,  1 }, { 1,  1 }
+    };
+}
+
+// How a built grid stores the boids of every cell
+enum class CellStorage
+{
+    Ranges,     // ranges of groupedGrid bounded by cellStart and cellEnd
+    Linked,     // linked lists from cellHead through cellNext
+    Buckets     // fixed slots per cell plus the shared overflow list
+};
+
+// Device-side view of a built grid, copied into kernels
+struct GridView
+{
+    GridLayout layout;
+    CellStorage storage;
+    const IdPair* groupedGrid;      // boids grouped by cell, cellStart/cellEnd bound every cell
+    const unsigned int* cellStart;
+    const unsigned int* cellEnd;
+    const int* cellHead;            // first boid of every cell, cellNext the boid after it, -1 ends a list
+    const int* cellNext;
+    CellBuckets buckets;
+    CellBounds bounds;              // occupancy and boxes, valid with cell culling
+
+    // Calls visit(j) for every boid j in the cell
+    template <typename VisitFunc>
+    void ForEachInCell(int cell, VisitFunc&& visit) const
+    {
+        if (storage == CellStorage::Linked)
+        {
+            for (int j = cellHead[cell]; j != -1; j = cellNext[j])
+                visit(j);
+            return;
+        }
+        if (storage == CellStorage::Buckets)
+        {
+            // A full bucket spilled the rest of its boids into its run of the grouped overflow
+            int count = buckets.counts[cell];
+            int held = count < buckets.capacity ? count : buckets.capacity;
+            for (int slot = 0; slot < held; slot++)
+                visit(buckets.slots[cell * buckets.capacity + slot]);
+            for (int spill = 0; spill < count - buckets.capacity; spill++)
+                visit(buckets.overflowIds[buckets.overflowStart[cell] + spill]);
+            return;
+        }
+        for (unsigned int particleNum = cellStart[cell]; particleNum < cellEnd[cell]; particleNum++)
+            visit(groupedGrid[particleNum].id);
+    }
+
+    // Calls visit(j) once for every boid j in the cells within radius of (x, y), farther boids may be visited too
+    template <typename VisitFunc>
+    void ForEachCandidate(const Boids* boids, float x, float y, float radius, VisitFunc&& visit) const
+    {
+        int col, row;
+        CellCoordinates(layout, x, y, col, row);
+        int reach = (int)sycl::ceil(radius / layout.cellSize);
+        auto visitCell = [&](int c, int r) {
+            int cell = CellId(layout, c, r);
+            if (!CellMayHold(bounds, cell, x, y, radius))
+                return;
+            ForEachInCell(cell, [&](int j) {
+                // A hash bucket may hold other cells of the stencil, take every boid in its own cell only
+                if (layout.hashed)
+                {
+                    int colFriend, rowFriend;
+                    CellCoordinates(layout, boids->positions.x[j], boids->positions.y[j], colFriend, rowFriend);
+                    if (colFriend != c || rowFriend != r)
+                        return;
+                }
+                visit(j);
+                });
+        };
+
+        // The ghost ring covers the stencil of every window cell, no cell needs a bounds check
+        if (reach == 1 && layout.ghosts >= 1)
+        {
+            for (int n = 0; n < kStencilCells; n++)
+                visitCell(col + kStencilOffsets[n][0], row + kStencilOffsets[n][1]);
+            return;
+        }
+        bool padded = reach <= layout.ghosts || layout.hashed;
+        for (int r = row - reach; r <= row + reach; r++)
+            for (int c = col - reach; c <= col + reach; c++)
+                if (padded || CellInGrid(layout, c, r))
+                    visitCell(c, r);
+    }
+
+    // Candidates within radius of boid i, boid i itself included
+    template <typename VisitFunc>
+    void ForEachNeighbor(const Boids* boids, int i, float radius, VisitFunc&& visit) const
+    {
+        ForEachCandidate(boids, boids->positions.x[i], boids->positions.y[i], radius, visit);
+    }
+
+    // For every center lists the boids within radius in results[query * capacity...], up to capacity of them,
+    // counts[query] is the number found
+    void QueryRadius(sycl::queue& q, const Boids* boids, const Point* centers, int count, float radius, int* results, int capacity, int* counts) const
+    {
+        GridView grid = *this;
+        q.parallel_for(sycl::range<1>{ (size_t)count }, [=](sycl::id<1> id) {
+            int query = id;
+            float x = centers[query].x;
+            float y = centers[query].y;
+            int found = 0;
+            grid.ForEachCandidate(boids, x, y, radius, [&](int j) {
+                float dx = boids->positions.x[j] - x;
+                float dy = boids->positions.y[j] - y;
+                if (dx * dx + dy * dy > radius * radius)
+                    return;
+                if (found < capacity)
+                    results[query * capacity + found] = j;
+                found++;
+                });
+            counts[query] = found;
+            }).wait();
+    }
+
+    // For every rectangle lists the boids inside in results[query * capacity...], up to capacity of them,
+    // counts[query] is the number found. Cost grows with the cells the rectangle covers.
+    void QueryRect(sycl::queue& q, const Boids* boids, const CellBox* rects, int count, int* results, int capacity, int* counts) const
+    {
+        GridView grid = *this;
+        q.parallel_for(sycl::range<1>{ (size_t)count }, [=](sycl::id<1> id) {
+            int query = id;
+            CellBox rect = rects[query];
+            int firstCol, firstRow, lastCol, lastRow;
+            CellCoordinates(grid.layout, rect.minX, rect.minY, firstCol, firstRow);
+            CellCoordinates(grid.layout, rect.maxX, rect.maxY, lastCol, lastRow);
+            int found = 0;
+            for (int r = firstRow; r <= lastRow; r++)
+                for (int c = firstCol; c <= lastCol; c++)
+                    grid.ForEachInCell(CellId(grid.layout, c, r), [&](int j) {
+                        float x = boids->positions.x[j];
+                        float y = boids->positions.y[j];
+                        if (x < rect.minX || x > rect.maxX || y < rect.minY || y > rect.maxY)
+                            return;
+                        // A hash bucket may hold other cells of the rectangle
+                        int col, row;
+                        CellCoordinates(grid.layout, x, y, col, row);
+                        if (grid.layout.hashed && (col != c || row != r))
+                            return;
+                        if (found < capacity)
+                            results[query * capacity + found] = j;
+                        found++;
+                        });
+            counts[query] = found;
+            }).wait();
+    }
+};
+
+namespace
+{
+    // CountBits usable in constant expressions
+    constexpr unsigned BitsFor(unsigned int number)
+    {
+        unsigned bits = 0;
+        while (number >> bits)
+            bits++;
+        return bits;
+    }
+
+    // Sort key holding the cell id above the boid id, one 32-bit word whenever both fit
+    constexpr unsigned kPackedIdBits = BitsFor(kUnitCount - 1);
+    constexpr unsigned kPackedCellBits = BitsFor(kCellTableCapacity - 1);
+    using PackedKey = std::conditional_t<kPackedIdBits + kPackedCellBits <= 32, unsigned int, unsigned long long>;
+    constexpr PackedKey kPackedIdMask = ((PackedKey)1 << kPackedIdBits) - 1;
+
+    void Swap(IdPair* a, IdPair* b)
+    {
+        IdPair t = *a;
+        *a = *b;
+        *b = t;
+    }
+
+    int Partition(IdPair* particlesGrid, int low, int high)
+    {
+        int pivot = particlesGrid[high].cellId;
+        int i = (low - 1);
+        for (int j = low; j <= high - 1; j++) {
+            if (particlesGrid[j].cellId < pivot) {
+                i++;
+                Swap(&particlesGrid[i], &particlesGrid[j]);
+            }
+        }
+        Swap(&particlesGrid[i + 1], &particlesGrid[high]);
+        return (i + 1);
+    }
+
+    void QuickSort(IdPair* particlesGrid, int low, int high)
+    {
+        if (low < high) {
+            int pi = Partition(particlesGrid, low, high);
+            QuickSort(particlesGrid, low, pi - 1);
+            QuickSort(particlesGrid, pi + 1, high);
+        }
+    }
+}
+
+// Uniform grid over the boids: cell assignment, grouping by cell with the backend chosen in the settings,
+// and neighbor queries. One build per frame is shared by every pass that needs neighbors.
+class SpatialGrid
+{
+public:
+    explicit SpatialGrid(sycl::queue& q)
+        : q(q)
+    {
+        particlesGrid = (IdPair*)sycl::malloc_shared(kUnitCount * sizeof(IdPair), q);
+        particlesGridHelper = (IdPair*)sycl::malloc_device(kUnitCount * sizeof(IdPair), q);
+        cellRank = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        cellStart = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        cellEnd = (unsigned int*)sycl::malloc_device(kCellTableCapacity * sizeof(unsigned int), q);
+        cellHead = (int*)sycl::malloc_device(kCellTableCapacity * sizeof(int), q);
+        cellNext = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        packedKeys = (PackedKey*)sycl::malloc_device(kUnitCount * sizeof(PackedKey), q);
+        packedKeysHelper = (PackedKey*)sycl::malloc_device(kUnitCount * sizeof(PackedKey), q);
+        incrementalGrid = AllocateIncrementalGrid(q);
+        cellBounds = AllocateCellBounds(q);
+        cellBuckets = AllocateCellBuckets(q);
+        queryCount = (int*)sycl::malloc_shared(sizeof(int), q);
+    }
+
+    ~SpatialGrid()
+    {
+        sycl::free(particlesGrid, q);
+        sycl::free(particlesGridHelper, q);
+        sycl::free(cellRank, q);
+        sycl::free(cellStart, q);
+        sycl::free(cellEnd, q);
+        sycl::free(cellHead, q);
+        sycl::free(cellNext, q);
+        sycl::free(packedKeys, q);
+        sycl::free(packedKeysHelper, q);
+        FreeIncrementalGrid(q, incrementalGrid);
+        FreeCellBounds(q, cellBounds);
+        FreeCellBuckets(q, cellBuckets);
+        sycl::free(queryCount, q);
+    }
+
+    SpatialGrid(const SpatialGrid&) = delete;
+    SpatialGrid& operator=(const SpatialGrid&) = delete;
+
+    // Groups the boids by cell from their current positions
+    void Build(const Settings& settings, Boids* boids, SortScratch& scratch)
+    {
+        sycl::range<1> numItems{ kUnitCount };
+        GridLayout layout = MakeGridLayout(settings.cellOrdering, settings.cellDivisions, settings.gridMethod == GridMethod::Hash);
+        IdPair* particlesGrid = this->particlesGrid;
+        unsigned int* cellStart = this->cellStart;
+        unsigned int* cellEnd = this->cellEnd;
+        PackedKey* packedKeys = this->packedKeys;
+
+        // The incremental grid repairs last frame's sorted list when few boids changed cell
+        bool repaired = settings.gridMethod == GridMethod::Incremental &&
+            RepairSortedGrid(q, boids, layout, particlesGrid, particlesGridHelper, incrementalGrid, settings.migrationThreshold, scratch);
+        bool sorted = settings.gridMethod == GridMethod::Sort || settings.gridMethod == GridMethod::Incremental;
+        bool packed = sorted && !repaired && settings.sortMethod == SortMethod::Radix && settings.sortKey == SortKey::Packed;
+
+        // Fill unordered list (id, cellid), or its packed keys
+        if (packed)
+        {
+            q.parallel_for(numItems, [=](sycl::id<1> i) {
+                PackedKey cellId = CellIdAt(layout, boids->positions.x[i], boids->positions.y[i]);
+                packedKeys[i] = (cellId << kPackedIdBits) | (PackedKey)i;
+                }).wait();
+        }
+        else if (!repaired)
+        {
+            q.parallel_for(numItems, [=](sycl::id<1> i) {
+                particlesGrid[i].cellId = CellIdAt(layout, boids->positions.x[i], boids->positions.y[i]);
+                particlesGrid[i].id = i;
+                }).wait();
+        }
+
+        // Group the list by cellId, cellStart/cellEnd bound every cell in the grouped list
+        IdPair* groupedGrid = particlesGrid;
+        if (settings.gridMethod == GridMethod::Linked)
+            BuildLinkedCells(q, particlesGrid, cellHead, cellNext, layout.tableSize);
+        else if (settings.gridMethod == GridMethod::Bucket)
+            BuildCellBuckets(q, particlesGrid, cellBuckets, layout, scratch);
+        else if (settings.gridMethod == GridMethod::Counting || settings.gridMethod == GridMethod::Hash)
+        {
+            BinParticles(q, particlesGrid, particlesGridHelper, cellRank, cellStart, cellEnd, layout.tableSize, scratch);
+            groupedGrid = particlesGridHelper;
+        }
+        else if (packed)
+        {
+            // Ids start in order and every pass is stable, so sorting the cell bits alone sorts the keys
+            RadixSort(q, packedKeys, packedKeysHelper, kUnitCount, CountBits(layout.tableSize - 1),
+                [](PackedKey key) { return (unsigned int)(key >> kPackedIdBits); }, scratch);
+
+            // Fill cellStart and cellEnd from the keys, and unpack them into the grouped list
+            q.memset(cellStart, 0, layout.tableSize * sizeof(unsigned int));
+            q.memset(cellEnd, 0, layout.tableSize * sizeof(unsigned int));
+            q.wait();
+            q.parallel_for(numItems, [=](sycl::id<1> i) {
+                PackedKey key = packedKeys[i];
+                int cellId = (int)(key >> kPackedIdBits);
+                if (i == 0 || (int)(packedKeys[i - 1] >> kPackedIdBits) != cellId)
+                    cellStart[cellId] = i;
+                if (i == kUnitCount - 1 || (int)(packedKeys[i + 1] >> kPackedIdBits) != cellId)
+                    cellEnd[cellId] = i + 1;
+                particlesGrid[i].id = (int)(key & kPackedIdMask);
+                particlesGrid[i].cellId = cellId;
+                }).wait();
+            incrementalGrid.valid = settings.gridMethod == GridMethod::Incremental;
+        }
+        else
+        {
+            if (!repaired && settings.sortMethod == SortMethod::Host)
+                QuickSort(particlesGrid, 0, kUnitCount - 1);
+            else if (!repaired)
+                RadixSort(q, particlesGrid, particlesGridHelper, kUnitCount, CountBits(layout.tableSize - 1),
+                    [](const IdPair& pair) { return (unsigned int)pair.cellId; }, scratch);
+
+            // Fill cellStart and cellEnd arrays, empty cells stay [0, 0)
+            q.memset(cellStart, 0, layout.tableSize * sizeof(unsigned int));
+            q.memset(cellEnd, 0, layout.tableSize * sizeof(unsigned int));
+            q.wait();
+            q.parallel_for(numItems, [=](sycl::id<1> i) {
+                int cellId = particlesGrid[i].cellId;
+                if (i == 0 || particlesGrid[i - 1].cellId != cellId)
+                    cellStart[cellId] = i;
+                if (i == kUnitCount - 1 || particlesGrid[i + 1].cellId != cellId)
+                    cellEnd[cellId] = i + 1;
+                }).wait();
+            incrementalGrid.valid = settings.gridMethod == GridMethod::Incremental;
+        }
+
+        view.layout = layout;
+        view.storage = settings.gridMethod == GridMethod::Linked ? CellStorage::Linked :
+            (settings.gridMethod == GridMethod::Bucket ? CellStorage::Buckets : CellStorage::Ranges);
+        view.groupedGrid = groupedGrid;
+        view.cellStart = cellStart;
+        view.cellEnd = cellEnd;
+        view.cellHead = cellHead;
+        view.cellNext = cellNext;
+        view.buckets = cellBuckets;
+
+        // Skip empty and out-of-range cells in the queries
+        cellBounds.valid = false;
+        view.bounds = cellBounds;
+        if (settings.cellCulling)
+        {
+            GridView grid = view;
+            BuildCellBounds(q, boids, layout, cellBounds, [=](int cell, auto&& visit) { grid.ForEachInCell(cell, visit); });
+            view.bounds = cellBounds;
+        }
+    }
+
+    // Forgets last frame's grouping, the next build starts from scratch
+    void Invalidate()
+    {
+        incrementalGrid.valid = false;
+    }
+
+    // View of the last build for kernels
+    const GridView& View() const
+    {
+        return view;
+    }
+
+    // Boids grouped by cell, null for linked cells and buckets. Reordering the boids into this order
+    // must renumber the ids in place.
+    IdPair* GroupedList() const
+    {
+        return view.storage == CellStorage::Ranges ? (IdPair*)view.groupedGrid : nullptr;
+    }
+
+    // Whether any boid of the last build is within radius of center
+    bool AnyWithin(const Boids* boids, const Point* center, float radius)
+    {
+        view.QueryRadius(q, boids, center, 1, radius, nullptr, 0, queryCount);
+        return *queryCount > 0;
+    }
+
+    // Prints how often the bucket grid overflowed, nothing when it never ran
+    void Report() const
+    {
+        ReportCellBuckets(cellBuckets);
+    }
+
+private:
+    sycl::queue& q;
+    IdPair* particlesGrid;          // (id, cellId) of every boid, sorted by cellId for the sort backends
+    IdPair* particlesGridHelper;    // sort buffer, grouped list of the counting and hash backends
+    int* cellRank;
+    unsigned int* cellStart;
+    unsigned int* cellEnd;
+    int* cellHead;
+    int* cellNext;
+    PackedKey* packedKeys;          // (cellId << kPackedIdBits) | id, sorted by the packed-key path
+    PackedKey* packedKeysHelper;
+    IncrementalGrid incrementalGrid;
+    CellBounds cellBounds;
+    CellBuckets cellBuckets;
+    int* queryCount;                // shared, result of AnyWithin
+    GridView view{};
+};
+#endif
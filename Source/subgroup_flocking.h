@@ -0,0 +1,94 @@
+#ifndef SUBGROUP_FLOCKING_H
+#define SUBGROUP_FLOCKING_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "flocking.h"
+#include "spatial_grid.h"
+
+namespace
+{
+    constexpr size_t kSubGroupWorkGroupSize = 64;
+    constexpr size_t kSubGroupLaunchLanes = 8;      // launch width per boid, the kernel adapts to the device sub-group size
+
+    // Every stencil cell is read as a contiguous range of the grouped list of a bounded grid
+    inline bool SubGroupFlockingApplies(const GridView& grid)
+    {
+        return grid.storage == CellStorage::Ranges && !grid.layout.hashed;
+    }
+
+    // Runs the flocking rules with one boid per sub-group. Lanes load the bounds of one stencil cell each
+    // and pass them around with shuffles, so every lane walks the same cells and the loop bounds agree
+    // across the sub-group. Within a cell lane k tests candidates k, k + lanes, ..., and the partial
+    // neighborhoods are summed with reductions before the first lane updates the boid.
+    void SubGroupFlockingStep(FlockingKernels& kernels, Boids* boids, const GridView& grid, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        GridView view = grid;
+        GridLayout cells = grid.layout;
+        size_t globalSize = (kUnitCount * kSubGroupLaunchLanes + kSubGroupWorkGroupSize - 1) / kSubGroupWorkGroupSize * kSubGroupWorkGroupSize;
+        sycl::nd_range<1> items{ sycl::range<1>(globalSize), sycl::range<1>(kSubGroupWorkGroupSize) };
+
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            kernels.Submit(rules.parameters, [&](sycl::handler& h) {
+                h.parallel_for<FlockingKernel<SubGroupSite, Rules>>(items, [=](sycl::nd_item<1> it, sycl::kernel_handler kh) {
+                    sycl::sub_group sg = it.get_sub_group();
+                    int lane = sg.get_local_linear_id();
+                    int lanes = sg.get_local_linear_range();
+                    int subGroups = it.get_group_range(0) * sg.get_group_linear_range();
+                    int reach = cells.divisions;
+                    int side = 2 * reach + 1;
+                    int stencilCells = side * side;
+
+                    // Boids are taken in grouped order, neighboring sub-groups then read the same cells
+                    for (int k = it.get_group_linear_id() * sg.get_group_linear_range() + sg.get_group_linear_id(); k < (int)kUnitCount; k += subGroups)
+                    {
+                        int i = view.groupedGrid[k].id;
+                        float x = boids->positions.x[i];
+                        float y = boids->positions.y[i];
+                        int col, row;
+                        CellCoordinates(cells, x, y, col, row);
+                        Neighborhood neighborhood;
+
+                        for (int batch = 0; batch < stencilCells; batch += lanes)
+                        {
+                            // Ghost cells keep the stencil of every window cell inside the grid
+                            unsigned int laneStart = 0;
+                            unsigned int laneEnd = 0;
+                            if (batch + lane < stencilCells)
+                            {
+                                int cell = CellId(cells, col + (batch + lane) % side - reach, row + (batch + lane) / side - reach);
+                                laneStart = view.cellStart[cell];
+                                laneEnd = view.cellEnd[cell];
+                            }
+                            int batchCells = stencilCells - batch < lanes ? stencilCells - batch : lanes;
+                            for (int s = 0; s < batchCells; s++)
+                            {
+                                unsigned int start = sycl::select_from_group(sg, laneStart, s);
+                                unsigned int end = sycl::select_from_group(sg, laneEnd, s);
+                                for (unsigned int n = start + lane; n < end; n += lanes)
+                                {
+                                    int j = view.groupedGrid[n].id;
+                                    if (j != i)
+                                        AddNeighbor<FastMath>(neighborhood, boids, x, y, j);
+                                }
+                            }
+                        }
+
+                        neighborhood.xAvoid = sycl::reduce_over_group(sg, neighborhood.xAvoid, sycl::plus<float>());
+                        neighborhood.yAvoid = sycl::reduce_over_group(sg, neighborhood.yAvoid, sycl::plus<float>());
+                        neighborhood.vxAvg = sycl::reduce_over_group(sg, neighborhood.vxAvg, sycl::plus<float>());
+                        neighborhood.vyAvg = sycl::reduce_over_group(sg, neighborhood.vyAvg, sycl::plus<float>());
+                        neighborhood.xAvg = sycl::reduce_over_group(sg, neighborhood.xAvg, sycl::plus<float>());
+                        neighborhood.yAvg = sycl::reduce_over_group(sg, neighborhood.yAvg, sycl::plus<float>());
+                        neighborhood.neighbors = sycl::reduce_over_group(sg, neighborhood.neighbors, sycl::plus<unsigned int>());
+                        if (lane == 0)
+                            UpdateBoid<Rules>(boids, i, neighborhood, SpecializedParameters(kh), mousePointer, temporaryPositions, temporaryVelocities);
+                    }
+                    });
+                }).wait();
+            });
+    }
+}
+#endif
@@ -0,0 +1,173 @@
+#ifndef SWEEP_AND_PRUNE_H
+#define SWEEP_AND_PRUNE_H
+#include <CL/sycl.hpp>
+#include <cfloat>
+#include "boids.h"
+#include "radix_sort.h"
+#include "flocking.h"
+#include "nearest_neighbors.h"
+
+// Boids sorted along one axis. Neighbors of a boid lie in the run of sorted boids whose coordinate
+// on that axis is within kVisualRange of its own, the run is found by walking outwards from its rank.
+struct SweepAndPrune
+{
+    unsigned int* keys;         // order-preserving bits of the sweep coordinate, sorted during the build
+    unsigned int* keysHelper;
+    int* ids;                   // boids in sweep order
+    int* idsHelper;
+    float* coordinates;         // sweep coordinate of every boid in sweep order
+    int* ranks;                 // position of every boid in sweep order
+    float* moments;             // shared, sums of x, y, x * x and y * y over the variance sample
+    bool alongY = false;        // axis of the last build
+};
+
+namespace
+{
+    constexpr int kSweepSamples = 256;          // boids in the variance estimate
+    constexpr float kSweepAnisotropy = 16.0f;   // variance ratio from which the automatic backend sweeps
+
+    SweepAndPrune AllocateSweepAndPrune(sycl::queue& q)
+    {
+        SweepAndPrune sweep;
+        sweep.keys = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        sweep.keysHelper = (unsigned int*)sycl::malloc_device(kUnitCount * sizeof(unsigned int), q);
+        sweep.ids = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        sweep.idsHelper = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        sweep.coordinates = (float*)sycl::malloc_device(kUnitCount * sizeof(float), q);
+        sweep.ranks = (int*)sycl::malloc_device(kUnitCount * sizeof(int), q);
+        sweep.moments = (float*)sycl::malloc_shared(4 * sizeof(float), q);
+        return sweep;
+    }
+
+    void FreeSweepAndPrune(sycl::queue& q, SweepAndPrune& sweep)
+    {
+        sycl::free(sweep.keys, q);
+        sycl::free(sweep.keysHelper, q);
+        sycl::free(sweep.ids, q);
+        sycl::free(sweep.idsHelper, q);
+        sycl::free(sweep.coordinates, q);
+        sycl::free(sweep.ranks, q);
+        sycl::free(sweep.moments, q);
+    }
+
+    // Maps a float to an unsigned int with the same order, negatives flip all bits, positives the sign
+    inline unsigned int SortableBits(float value)
+    {
+        unsigned int bits = sycl::bit_cast<unsigned int>(value);
+        return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    }
+
+    // Variance of x and y over an evenly strided sample of the boids
+    void EstimateVariances(sycl::queue& q, const Boids* boids, SweepAndPrune& sweep, float& varianceX, float& varianceY)
+    {
+        float* moments = sweep.moments;
+        q.single_task([=]() {
+            float sums[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int s = 0; s < kSweepSamples; s++)
+            {
+                size_t i = s * (kUnitCount / kSweepSamples);
+                float x = boids->positions.x[i];
+                float y = boids->positions.y[i];
+                sums[0] += x;
+                sums[1] += y;
+                sums[2] += x * x;
+                sums[3] += y * y;
+            }
+            for (int m = 0; m < 4; m++)
+                moments[m] = sums[m] / kSweepSamples;
+            }).wait();
+        varianceX = moments[2] - moments[0] * moments[0];
+        varianceY = moments[3] - moments[1] * moments[1];
+    }
+
+    // Sweeping pays off once the flock is stretched along one axis, a thin slab across the long axis
+    // then holds few boids while grid cells along the lanes are overloaded
+    inline bool SweepPaysOff(float varianceX, float varianceY)
+    {
+        float low = sycl::min(varianceX, varianceY);
+        float high = sycl::max(varianceX, varianceY);
+        return high >= kSweepAnisotropy * low;
+    }
+
+    // Sorts the boids along x, or along y when alongY is set
+    void BuildSweepAndPrune(sycl::queue& q, const Boids* boids, SweepAndPrune& sweep, bool alongY, SortScratch& scratch)
+    {
+        sycl::range<1> numItems{ kUnitCount };
+        unsigned int* keys = sweep.keys;
+        int* ids = sweep.ids;
+        float* coordinates = sweep.coordinates;
+        int* ranks = sweep.ranks;
+        const float* axis = alongY ? boids->positions.y : boids->positions.x;
+
+        q.parallel_for(numItems, [=](sycl::id<1> i) {
+            keys[i] = SortableBits(axis[i]);
+            ids[i] = i;
+            }).wait();
+        RadixSortByKey(q, keys, ids, sweep.keysHelper, sweep.idsHelper, kUnitCount, 32, scratch);
+
+        q.parallel_for(numItems, [=](sycl::id<1> k) {
+            coordinates[k] = axis[ids[k]];
+            ranks[ids[k]] = k;
+            }).wait();
+        sweep.alongY = alongY;
+    }
+
+    // Calls visit(j) for every boid j whose sweep coordinate is within range of boid i's, i included
+    template <typename VisitFunc>
+    inline void ForEachInSweep(const SweepAndPrune& sweep, int i, float range, VisitFunc&& visit)
+    {
+        int rank = sweep.ranks[i];
+        float coordinate = sweep.coordinates[rank];
+        for (int k = rank; k < (int)kUnitCount && sweep.coordinates[k] - coordinate <= range; k++)
+            visit(sweep.ids[k]);
+        for (int k = rank - 1; k >= 0 && coordinate - sweep.coordinates[k] <= range; k--)
+            visit(sweep.ids[k]);
+    }
+
+    // Pushes the nearestCount nearest boids to boid i at (x, y) into heap. The walk alternates between
+    // both directions and stops on a side once the axis gap alone exceeds the farthest entry of a full heap.
+    inline void NearestInSweep(const SweepAndPrune& sweep, const Boids* boids, int i, float x, float y, int nearestCount, NeighborHeap& heap)
+    {
+        int rank = sweep.ranks[i];
+        float coordinate = sweep.coordinates[rank];
+        int up = rank + 1;
+        int down = rank - 1;
+        auto push = [&](int k) {
+            int j = sweep.ids[k];
+            float dx = boids->positions.x[j] - x;
+            float dy = boids->positions.y[j] - y;
+            PushNeighbor(heap, nearestCount, dx * dx + dy * dy, j);
+        };
+        while (up < (int)kUnitCount || down >= 0)
+        {
+            float bound = heap.size == nearestCount ? heap.distances[0] : FLT_MAX;
+            float gapUp = up < (int)kUnitCount ? sweep.coordinates[up] - coordinate : FLT_MAX;
+            float gapDown = down >= 0 ? coordinate - sweep.coordinates[down] : FLT_MAX;
+            if (gapUp * gapUp >= bound && gapDown * gapDown >= bound)
+                break;
+            if (gapUp <= gapDown)
+                push(up++);
+            else
+                push(down--);
+        }
+    }
+
+    // Runs the flocking rules with neighbors found along the sweep axis
+    void SweepFlockingStep(FlockingKernels& kernels, Boids* boids, const SweepAndPrune& sweep, int nearestCount, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        SweepAndPrune sorted = sweep;
+        if (nearestCount > 0)
+        {
+            NearestFlockingStep<NearestSweepSite>(kernels, boids, nearestCount, mousePointer, temporaryPositions, temporaryVelocities, rules,
+                [=](int i, float x, float y, NeighborHeap& heap) {
+                    NearestInSweep(sorted, boids, i, x, y, nearestCount, heap);
+                });
+            return;
+        }
+        FlockingStep<SweepSite>(kernels, boids, mousePointer, temporaryPositions, temporaryVelocities, rules, [=](int i, auto&& visit) {
+            ForEachInSweep(sorted, i, kVisualRange, visit);
+            });
+    }
+}
+#endif
@@ -0,0 +1,101 @@
+#ifndef SYMMETRIC_FLOCKING_H
+#define SYMMETRIC_FLOCKING_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "flocking.h"
+#include "spatial_grid.h"
+
+namespace
+{
+    // Evaluates the pair (i, j) once and adds it to the sums of both boids
+    template <bool FastMath>
+    inline void AddPair(Neighborhood* sums, const Boids* boids, int i, int j)
+    {
+        float xi = boids->positions.x[i];
+        float yi = boids->positions.y[i];
+        float xj = boids->positions.x[j];
+        float yj = boids->positions.y[j];
+        float measure = RangeMeasure<FastMath>((xj - xi) * (xj - xi) + (yj - yi) * (yj - yi));
+        if (measure > RangeLimit<FastMath>(kVisualRange))
+            return;
+        bool avoid = measure < RangeLimit<FastMath>(kProtectedRange);
+        AddNeighborAt(sums[i], boids, xi, yi, j, avoid);
+        AddNeighborAt(sums[j], boids, xj, yj, i, avoid);
+    }
+
+    // Runs the flocking rules visiting every pair once. A cell pairs its own boids and the boids of the
+    // forward half of its stencil (rows below, and cells to the right in its own row), so distance work
+    // halves. A cell writes the sums of its own boids and of its forward cells, two cells at least 2k+1
+    // columns or k+1 rows apart never write the same sums, so cells are processed one color at a time
+    // from (2k+1)(k+1) colors without atomics. Needs a bounded grid, hash buckets alias distant cells.
+    // Every launch depends on the one before, so the colors queue back to back and only the end waits.
+    void SymmetricFlockingStep(sycl::queue& q, FlockingKernels& kernels, Boids* boids, const GridView& grid, Neighborhood* sums, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        GridView view = grid;
+        GridLayout cells = grid.layout;
+        int reach = cells.divisions;
+        int colorCols = 2 * reach + 1;
+        int colorRows = reach + 1;
+
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            sycl::event previous = q.memset(sums, 0, kUnitCount * sizeof(Neighborhood));
+            for (int color = 0; color < colorCols * colorRows; color++)
+            {
+                int firstCol = color % colorCols;
+                int firstRow = color / colorCols;
+                int colsOfColor = (cells.cols - firstCol + colorCols - 1) / colorCols;
+                int rowsOfColor = (cells.rows - firstRow + colorRows - 1) / colorRows;
+                if (colsOfColor <= 0 || rowsOfColor <= 0)
+                    continue;
+
+                previous = q.submit([&](sycl::handler& h) {
+                    h.depends_on(previous);
+                    h.parallel_for(sycl::range<1>{ (size_t)(colsOfColor * rowsOfColor) }, [=](sycl::id<1> id) {
+                        int k = id;
+                        int c = firstCol + k % colsOfColor * colorCols;
+                        int r = firstRow + k / colsOfColor * colorRows;
+                        int cell = CellId(cells, c, r);
+
+                        // Pairs inside the cell
+                        int a = 0;
+                        view.ForEachInCell(cell, [&](int i) {
+                            int b = 0;
+                            view.ForEachInCell(cell, [&](int j) {
+                                if (b++ > a)
+                                    AddPair<FastMath>(sums, boids, i, j);
+                                });
+                            a++;
+                            });
+
+                        // Pairs with the forward half of the stencil
+                        for (int dr = 0; dr <= reach; dr++)
+                            for (int dc = -reach; dc <= reach; dc++)
+                            {
+                                // Forward cells past the window edge are ghost cells, always empty
+                                if (dr == 0 && dc <= 0)
+                                    continue;
+                                int other = CellId(cells, c + dc, r + dr);
+                                view.ForEachInCell(cell, [&](int i) {
+                                    view.ForEachInCell(other, [&](int j) {
+                                        AddPair<FastMath>(sums, boids, i, j);
+                                        });
+                                    });
+                            }
+                        });
+                    });
+            }
+
+            kernels.Submit(rules.parameters, [&](sycl::handler& h) {
+                h.depends_on(previous);
+                h.parallel_for<FlockingKernel<SymmetricSite, Rules>>(sycl::range<1>{ kUnitCount }, [=](sycl::id<1> id, sycl::kernel_handler kh) {
+                    int i = id;
+                    UpdateBoid<Rules>(boids, i, sums[i], SpecializedParameters(kh), mousePointer, temporaryPositions, temporaryVelocities);
+                    });
+                }).wait();
+            });
+    }
+}
+#endif
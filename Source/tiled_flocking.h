@@ -0,0 +1,101 @@
+#ifndef TILED_FLOCKING_H
+#define TILED_FLOCKING_H
+#include <CL/sycl.hpp>
+#include "boids.h"
+#include "flocking.h"
+#include "spatial_grid.h"
+
+namespace
+{
+    constexpr size_t kTileSize = 64;    // work-items per group and boids per staged tile
+
+    // The tiled kernel needs every cell as a contiguous range of the grouped list and a bounded grid
+    inline bool TiledFlockingApplies(const GridView& grid)
+    {
+        return grid.storage == CellStorage::Ranges && !grid.layout.hashed;
+    }
+
+    // Runs the flocking rules with one work-group per window cell. The group takes the boids of its cell
+    // kTileSize at a time, and for every stencil cell loads kTileSize neighbors at a time into local
+    // memory with one read per work-item, then every boid of the group tests the whole tile. A neighbor
+    // is read from global memory once per group instead of once per boid of the cell.
+    void TiledFlockingStep(FlockingKernels& kernels, Boids* boids, const GridView& grid, const Point* mousePointer,
+        Positions* temporaryPositions, Velocities* temporaryVelocities, const FlockingRules& rules)
+    {
+        GridView view = grid;
+        GridLayout cells = grid.layout;
+        size_t windowCells = (size_t)cells.cols * cells.rows;
+        sycl::nd_range<1> groups{ sycl::range<1>(windowCells * kTileSize), sycl::range<1>(kTileSize) };
+
+        DispatchRules(rules, [&](auto ruleSet) {
+            using Rules = decltype(ruleSet);
+            constexpr bool FastMath = Rules::fastMath;
+            kernels.Submit(rules.parameters, [&](sycl::handler& h) {
+                sycl::local_accessor<float, 1> tileX(sycl::range<1>(kTileSize), h);
+                sycl::local_accessor<float, 1> tileY(sycl::range<1>(kTileSize), h);
+                sycl::local_accessor<float, 1> tileVx(sycl::range<1>(kTileSize), h);
+                sycl::local_accessor<float, 1> tileVy(sycl::range<1>(kTileSize), h);
+                sycl::local_accessor<int, 1> tileIds(sycl::range<1>(kTileSize), h);
+                h.parallel_for<FlockingKernel<TiledSite, Rules>>(groups, [=](sycl::nd_item<1> it, sycl::kernel_handler kh) {
+                    int group = it.get_group_linear_id();
+                    unsigned int local = it.get_local_id(0);
+                    int c = group % cells.cols;
+                    int r = group / cells.cols;
+                    int cell = CellId(cells, c, r);
+                    unsigned int ownEnd = view.cellEnd[cell];
+                    int reach = cells.divisions;
+
+                    // Bounds are the same for the whole group, so every work-item reaches every barrier
+                    for (unsigned int base = view.cellStart[cell]; base < ownEnd; base += kTileSize)
+                    {
+                        bool active = base + local < ownEnd;
+                        int i = active ? view.groupedGrid[base + local].id : 0;
+                        float x = boids->positions.x[i];
+                        float y = boids->positions.y[i];
+                        Neighborhood neighborhood;
+
+                        // Ghost cells keep the stencil of every window cell inside the grid
+                        for (int dr = -reach; dr <= reach; dr++)
+                            for (int dc = -reach; dc <= reach; dc++)
+                            {
+                                int other = CellId(cells, c + dc, r + dr);
+                                unsigned int otherEnd = view.cellEnd[other];
+                                for (unsigned int tile = view.cellStart[other]; tile < otherEnd; tile += kTileSize)
+                                {
+                                    if (tile + local < otherEnd)
+                                    {
+                                        int j = view.groupedGrid[tile + local].id;
+                                        tileIds[local] = j;
+                                        tileX[local] = boids->positions.x[j];
+                                        tileY[local] = boids->positions.y[j];
+                                        tileVx[local] = boids->velocities.vx[j];
+                                        tileVy[local] = boids->velocities.vy[j];
+                                    }
+                                    sycl::group_barrier(it.get_group());
+
+                                    unsigned int tileCount = otherEnd - tile < kTileSize ? otherEnd - tile : kTileSize;
+                                    for (unsigned int t = 0; active && t < tileCount; t++)
+                                    {
+                                        if (tileIds[t] == i)
+                                            continue;
+                                        float dx = tileX[t] - x;
+                                        float dy = tileY[t] - y;
+                                        float measure = RangeMeasure<FastMath>(dx * dx + dy * dy);
+                                        if (measure > RangeLimit<FastMath>(kVisualRange))
+                                            continue;
+                                        AddNeighborState(neighborhood, x, y, tileX[t], tileY[t], tileVx[t], tileVy[t],
+                                            measure < RangeLimit<FastMath>(kProtectedRange));
+                                    }
+                                    sycl::group_barrier(it.get_group());
+                                }
+                            }
+
+                        if (active)
+                            UpdateBoid<Rules>(boids, i, neighborhood, SpecializedParameters(kh), mousePointer, temporaryPositions, temporaryVelocities);
+                    }
+                    });
+                }).wait();
+            });
+    }
+}
+#endif